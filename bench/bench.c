@@ -0,0 +1,482 @@
+/*
+ * bench.c - microbenchmarks of the I/O, formatting, queue and sensor hot paths
+ *
+ * Runs the panel's own code in the host build, and the control core alone
+ * where a case has a _core twin. Register access goes through
+ * the simulated peripherals, with a virtual clock so no system call is made
+ * in the timed loops; paths that touch registers include that cost.
+ *
+ * With -a, each case is timed in this build and in a base build in turn,
+ * one process per run, so that both see the machine as it is at the time:
+ * on a shared machine the same code can be a third slower from one minute
+ * to the next, and a baseline saved in a file takes that for a regression.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <plio.h>
+#include <track.h>
+#include <train.h>
+#include <command.h>
+#include <telemetry.h>
+#include <control.h>
+#include <rule.h>
+#include "train_control_panel.h"
+#include "host/host.h"
+
+#define BENCH_CASE_MIN_NS (10 * 1000 * 1000ULL)	// Time spent in each round
+#define BENCH_ROUNDS 11	// The best round is kept
+#define BENCH_THRESHOLD 50	// Percent slower than the baseline that fails
+#define BENCH_RETRIES 3	// A regressed case is measured again, to rule out a noisy machine
+#define BENCH_PAIRS 5	// Runs of the base build and of this one, in turn, for each case of -a
+#define BENCH_PAIR_ROUNDS 3	// Rounds of a run of -r
+#define BENCH_NAME_MAX 32
+
+/*
+ * A case runs its operation n times. prepare() is called before each run,
+ * outside of the timed region, and n never exceeds batch, so that the
+ * buffers under test neither fill nor drain.
+ */
+typedef struct BenchCase {
+	const char *name;
+	unsigned int batch;
+	void (*prepare)( unsigned int n );
+	void (*run)( unsigned int n );
+} BenchCase;
+
+typedef struct BenchResult {
+	double ns;
+	double cycles;
+} BenchResult;
+
+static char bench_plio_buffer[CHANNEL_COUNT * OUTPUT_BUFFER_SIZE];
+static volatile unsigned int bench_sink;
+
+/*
+ * Clocks
+ */
+
+static unsigned long long benchNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static unsigned long long benchCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Cases
+ */
+
+static void resetPlio( unsigned int n ) {
+	int i, j;
+	for(i = 0; i < CHANNEL_COUNT; i++) {
+		for(j = 0; j < PLLANE_TOTAL; j++) {
+			plchannel(i)->lanes[j].send_index = 0;
+			plchannel(i)->lanes[j].save_index = 0;
+			plchannel(i)->lanes[j].frame = 0;
+		}
+	}
+}
+
+static void resetTrainCommands( unsigned int n ) {
+	resetPlio(n);
+	control_loop.save_index[TRAIN_LANE_ROUTINE] = 0;
+	control_loop.send_index[TRAIN_LANE_ROUTINE] = 0;
+	control_loop.pause_time = 0;
+	trainBootstrap(sendTrainSpeed);
+}
+
+static void fillPlio( unsigned int n ) {
+	unsigned int i;
+	resetPlio(n);
+	for(i = 0; i < n; i++) plputc(COM2, 'x');
+}
+
+static void runPlui2a( unsigned int n ) {
+	char bf[12];
+	unsigned int i;
+	for(i = 0; i < n; i++) {
+		plui2a(i * 2654435761U, 10, bf);
+		bench_sink += bf[0];
+	}
+}
+
+static void runPlprintfCursor( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) plprintf(COM2, "%c[%d;%dH", 27, i % 35 + 1, i % 80 + 1);
+}
+
+static void runPlprintfString( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) plprintf(COM2, "%s %u ok", "Running", i);
+}
+
+static void runPlsave( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) plputc(COM2, 'x');
+}
+
+// A byte per pass of the polling loop, each on a fresh snapshot of the flags
+static void runPlsend( unsigned int n ) {
+	PlChannel *ch = plchannel(COM2);
+	unsigned int i;
+	for(i = 0; i < n; i++) {
+		plchinvalidate(ch);
+		bench_sink += plsend(COM2);
+	}
+}
+
+static void runPlchsave( unsigned int n ) {
+	PlChannel *ch = plchannel(COM2);
+	unsigned int i;
+	for(i = 0; i < n; i++) plchsave(ch, 'x');
+}
+
+static void runPlchsend( unsigned int n ) {
+	PlChannel *ch = plchannel(COM2);
+	unsigned int i;
+	for(i = 0; i < n; i++) {
+		plchinvalidate(ch);
+		bench_sink += plchsend(ch);
+	}
+}
+
+// A byte per pass into an empty lane, with the UART ready: written through
+static void runPlchsaveDirect( unsigned int n ) {
+	PlChannel *ch = plchannel(COM2);
+	unsigned int i;
+	for(i = 0; i < n; i++) {
+		plchinvalidate(ch);
+		bench_sink += plchsave(ch, 'x');
+	}
+}
+
+static void runPrintAsciControl( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) printAsciControl(COM2, "H", i % 35 + 1, i % 80 + 1);
+}
+
+static void runTrainCommand( unsigned int n ) {
+	PlChannel *com1 = plchannel(COM1);
+	unsigned int i;
+	for(i = 0; i < n; i++) {
+		pushTrainCommand(i % 15, 0, 0);
+		popTrainCommand(1);
+		plchinvalidate(com1);
+		plsend(COM1);
+	}
+}
+
+static void runSaveDecoderData( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) saveDecoderData(i % 10, (i & 1) ? 0x80 >> (i % 8) : 0);
+}
+
+// Without the panel as the client, as the host tools and simulators link the core
+static void runSaveDecoderDataCore( unsigned int n ) {
+	const ControlHandlers *handlers = controlSetHandlers(0);
+	runSaveDecoderData(n);
+	controlSetHandlers(handlers);
+}
+
+static void prepareRule( unsigned int n ) {
+	static const CommandRecord rule[2] = {
+		{ COMMAND_RULE, 1, { { 0, COMMAND_EDGE_RISING } } },
+		{ COMMAND_SWITCH, 1, { { 12, TRACK_DIR_CURVED } } },
+	};
+	resetTrainCommands(n);
+	control_loop.save_index[TRAIN_LANE_RULE] = 0;
+	control_loop.send_index[TRAIN_LANE_RULE] = 0;
+	if(ruleTotal() == 0) controlSubmit(rule);
+}
+
+// A1 tripped every other byte, its rule queues a switch ahead of the routine commands
+static void runSaveDecoderDataRule( unsigned int n ) {
+	const ControlHandlers *handlers = controlSetHandlers(0);
+	unsigned int i;
+	for(i = 0; i < n; i++) saveDecoderData(0, (i & 1) ? 0x80 : 0);
+	controlSetHandlers(handlers);
+	ruleRemove(0);
+}
+
+static void runTelemetrySensor( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) telemetrySensor(i % 10, i, i & 0x0f);
+}
+
+static void runUserCommandTrain( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) bench_sink += handleUserCommand("tr 35 10");
+}
+
+static void prepareCommandFrame( unsigned int n ) {
+	static const unsigned char payload[] = { COMMAND_TRAIN, 1, 35, 10 };
+	resetTrainCommands(n);
+	command_frame.type = TELEMETRY_COMMANDS;
+	command_frame.size = sizeof(payload);
+	memcpy(command_frame.payload, payload, sizeof(payload));
+}
+
+// Headless, as the clients sending frames run it: the acknowledgement is a frame, not a screen update
+static void runCommandFrameTrain( unsigned int n ) {
+	unsigned int i;
+	panel_loop.headless = 1;
+	for(i = 0; i < n; i++) bench_sink += handleCommandFrame(1);
+	panel_loop.headless = 0;
+}
+
+static void runUserCommandSwitch( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) bench_sink += handleUserCommand((i & 1) ? "sw 5 C" : "sw 5 S");
+}
+
+static void runSubmitSwitch( unsigned int n ) {
+	static CommandRecord records[2] = {
+		{ COMMAND_SWITCH, 1, { { 5, TRACK_DIR_STRAIGHT } } },
+		{ COMMAND_SWITCH, 1, { { 5, TRACK_DIR_CURVED } } },
+	};
+	const ControlHandlers *handlers = controlSetHandlers(0);
+	unsigned int i;
+	for(i = 0; i < n; i++) bench_sink += controlSubmit(&records[i & 1]);
+	controlSetHandlers(handlers);
+}
+
+static void runUserCommandRoute( unsigned int n ) {
+	unsigned int i;
+	for(i = 0; i < n; i++) bench_sink += handleUserCommand("route A1 C13");
+}
+
+static const BenchCase bench_cases[] = {
+	{ "plui2a", 100000, 0, runPlui2a },
+	{ "plprintf_cursor", 1000, resetPlio, runPlprintfCursor },
+	{ "plprintf_string", 1000, resetPlio, runPlprintfString },
+	{ "plsave", 10000, resetPlio, runPlsave },
+	{ "plsend", 10000, fillPlio, runPlsend },
+	{ "plchsave", 10000, resetPlio, runPlchsave },
+	{ "plchsend", 10000, fillPlio, runPlchsend },
+	{ "plchsave_direct", 10000, resetPlio, runPlchsaveDirect },
+	{ "printAsciControl", 1000, resetPlio, runPrintAsciControl },
+	{ "push_pop_sendTrainCommand", 10000, resetTrainCommands, runTrainCommand },
+	{ "saveDecoderData", 250, resetPlio, runSaveDecoderData },
+	{ "saveDecoderData_core", 250, resetPlio, runSaveDecoderDataCore },
+	{ "saveDecoderData_rule_core", 40, prepareRule, runSaveDecoderDataRule },
+	{ "telemetrySensor", 1000, resetPlio, runTelemetrySensor },
+	{ "handleUserCommand_tr", 90, resetTrainCommands, runUserCommandTrain },
+	{ "handleCommandFrame_tr", 20, prepareCommandFrame, runCommandFrameTrain },
+	{ "handleUserCommand_sw", 90, resetTrainCommands, runUserCommandSwitch },
+	{ "controlSubmit_sw_core", 90, resetTrainCommands, runSubmitSwitch },
+	{ "handleUserCommand_route", 10, resetTrainCommands, runUserCommandRoute },
+};
+
+#define BENCH_CASE_TOTAL (sizeof(bench_cases) / sizeof(BenchCase))
+
+/*
+ * Harness
+ */
+
+static void benchSetup() {
+	// Virtual clock, and lines fast enough that the UARTs are never full
+	HalUartConfig uart = { 16, 2000000000 };
+	halSetClock(100);
+	halConfigure(COM1, &uart);
+	halConfigure(COM2, &uart);
+
+	plbootstrap(bench_plio_buffer);
+	telemetryBootstrap(COM2);
+	panelBootstrap();
+	resetTrainCommands(0);
+}
+
+static BenchResult benchRun( const BenchCase *bench, int rounds ) {
+	BenchResult best = { 0, 0 };
+	int round;
+	for(round = 0; round < rounds; round++) {
+		unsigned long long ops = 0, ns = 0, cycles = 0;
+		while(ns < BENCH_CASE_MIN_NS) {
+			if(bench->prepare != 0) bench->prepare(bench->batch);
+			unsigned long long start = benchNow(), start_cycles = benchCycles();
+			bench->run(bench->batch);
+			cycles += benchCycles() - start_cycles;
+			ns += benchNow() - start;
+			ops += bench->batch;
+		}
+		if(round == 0 || (double)ns / ops < best.ns) {
+			best.ns = (double)ns / ops;
+			best.cycles = (double)cycles / ops;
+		}
+	}
+	return best;
+}
+
+// Return: 1 with the result of a case run by the build at path, with -r, 0 if it could not be run
+static int benchSpawn( const char *path, const char *name, BenchResult *result ) {
+	char command[256];
+	snprintf(command, sizeof(command), "%s -r %s", path, name);
+	FILE *run = popen(command, "r");
+	if(run == 0) return 0;
+	int found = fscanf(run, "%lf %lf", &result->ns, &result->cycles) == 2;
+	return pclose(run) == 0 && found;
+}
+
+// The best of BENCH_PAIRS runs of each build, the first to run alternating
+static int benchPairs( const char *self, const char *base, const char *name, BenchResult *result, BenchResult *based ) {
+	int pair;
+	for(pair = 0; pair < BENCH_PAIRS; pair++) {
+		BenchResult ours, theirs;
+		if(pair & 1) {
+			if(!benchSpawn(self, name, &ours) || !benchSpawn(base, name, &theirs)) return 0;
+		}
+		else if(!benchSpawn(base, name, &theirs) || !benchSpawn(self, name, &ours)) return 0;
+		if(pair == 0 || ours.ns < result->ns) *result = ours;
+		if(pair == 0 || theirs.ns < based->ns) *based = theirs;
+	}
+	return 1;
+}
+
+// Return: ns/op of the case in the baseline file, 0 if not found
+static double baselineFind( const char *path, const char *name ) {
+	FILE *file = fopen(path, "r");
+	if(file == 0) return 0;
+	char line[128], found[BENCH_NAME_MAX];
+	double ns = 0, value;
+	while(fgets(line, sizeof(line), file) != 0) {
+		if(line[0] == '#') continue;
+		if(sscanf(line, "%31s %lf", found, &value) == 2 && strcmp(found, name) == 0) ns = value;
+	}
+	fclose(file);
+	return ns;
+}
+
+static void usage( const char *name ) {
+	fprintf(stderr,
+		"Usage: %s [options] [case...]\n"
+		"  -a, --against PATH       compare with the build at PATH, each case run by both in turn,\n"
+		"                           fail if a case is slower by more than the threshold\n"
+		"  -b, --baseline FILE      compare with FILE instead, saved by -w on this machine\n"
+		"  -t, --threshold PCT      threshold of -a and -b in percent (default %d)\n"
+		"  -r, --run CASE           print the ns/op and cycles/op of CASE alone, as -a runs it\n"
+		"  -w, --write FILE         save the results as the new baseline\n"
+		"  -l, --list               list the cases\n",
+		name, BENCH_THRESHOLD);
+}
+
+int main( int argc, char *argv[] ) {
+	static const struct option options[] = {
+		{ "against", required_argument, 0, 'a' },
+		{ "baseline", required_argument, 0, 'b' },
+		{ "run", required_argument, 0, 'r' },
+		{ "threshold", required_argument, 0, 't' },
+		{ "write", required_argument, 0, 'w' },
+		{ "list", no_argument, 0, 'l' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	const char *against = 0, *baseline = 0, *write = 0, *run = 0;
+	double threshold = BENCH_THRESHOLD;
+	int option, i, j, regressions = 0;
+
+	while((option = getopt_long(argc, argv, "a:b:r:t:w:lh", options, 0)) != -1) {
+		switch(option) {
+			case 'a':
+				against = optarg;
+				break;
+			case 'b':
+				baseline = optarg;
+				break;
+			case 'r':
+				run = optarg;
+				break;
+			case 't':
+				threshold = atof(optarg);
+				break;
+			case 'w':
+				write = optarg;
+				break;
+			case 'l':
+				for(i = 0; i < BENCH_CASE_TOTAL; i++) printf("%s\n", bench_cases[i].name);
+				return 0;
+			default:
+				usage(argv[0]);
+				return option == 'h' ? 0 : 1;
+		}
+	}
+
+	if(run != 0) {
+		for(i = 0; i < BENCH_CASE_TOTAL && strcmp(bench_cases[i].name, run) != 0; i++);
+		if(i == BENCH_CASE_TOTAL) {
+			fprintf(stderr, "No case %s\n", run);
+			return 1;
+		}
+		benchSetup();
+		BenchResult result = benchRun(&bench_cases[i], BENCH_PAIR_ROUNDS);
+		printf("%.1f %.1f\n", result.ns, result.cycles);
+		return 0;
+	}
+
+	FILE *output = 0;
+	if(write != 0 && (output = fopen(write, "w")) == 0) {
+		fprintf(stderr, "Unable to write %s\n", write);
+		return 1;
+	}
+	if(output != 0) fprintf(output, "# case ns/op cycles/op, written by make bench-baseline\n");
+
+	benchSetup();
+	printf("%-26s %10s %10s %10s %8s\n", "case", "ns/op", "cycles/op", "baseline", "change");
+	for(i = 0; i < BENCH_CASE_TOTAL; i++) {
+		const BenchCase *bench = &bench_cases[i];
+		if(optind < argc) {
+			for(j = optind; j < argc && strcmp(argv[j], bench->name) != 0; j++);
+			if(j == argc) continue;
+		}
+
+		double base = baseline != 0 ? baselineFind(baseline, bench->name) : 0;
+		BenchResult result, based;
+		if(against != 0) {
+			if(!benchPairs(argv[0], against, bench->name, &result, &based)) {
+				fprintf(stderr, "Unable to run %s of %s -r, or of %s\n", bench->name, against, argv[0]);
+				return 1;
+			}
+			base = based.ns;
+		}
+		else result = benchRun(bench, BENCH_ROUNDS);
+
+		// Measured again, base included, the least slow of the runs kept
+		int retry;
+		for(retry = 0; base > 0 && retry < BENCH_RETRIES && (result.ns - base) * 100 / base > threshold; retry++) {
+			BenchResult again, again_based = { base, 0 };
+			if(against == 0) again = benchRun(bench, BENCH_ROUNDS);
+			else if(!benchPairs(argv[0], against, bench->name, &again, &again_based)) break;
+			if(again.ns / again_based.ns < result.ns / base) {
+				result = again;
+				base = again_based.ns;
+			}
+		}
+		printf("%-26s %10.1f %10.1f", bench->name, result.ns, result.cycles);
+		if(output != 0) fprintf(output, "%s %.1f %.1f\n", bench->name, result.ns, result.cycles);
+
+		if(base > 0) {
+			double change = (result.ns - base) * 100 / base;
+			int regressed = change > threshold;
+			printf(" %10.1f %+7.1f%%%s", base, change, regressed ? "  REGRESSED" : "");
+			regressions += regressed;
+		}
+		printf("\n");
+	}
+
+	if(output != 0) fclose(output);
+	if(regressions > 0) {
+		printf("%d case(s) slower than the baseline by more than %.0f%%\n", regressions, threshold);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * command.c - table driven parser of user commands into binary records
+ */
+
+#include <command.h>
+#include <track.h>
+#include <train.h>
+
+#define COMMAND_NAME_FIRST 'a'
+#define COMMAND_NAME_LAST 'z'
+#define COMMAND_NUMBER_MAX 255
+
+/*
+ * Operand kinds in a schema:
+ * 	n	number in [0 - 255]
+ * 	t	train number
+ * 	w	switch id
+ * 	d	switch direction, 'S' or 'C'
+ * 	s	sensor name, e.g. A5
+ * 	e	edge, see parseRule
+ * A repeating schema accepts up to COMMAND_OPERANDS_MAX operands.
+ * Commands that switch the input itself are not taken from binary frames.
+ * Only the commands of the control core may be the action of a rule.
+ */
+typedef struct CommandSyntax {
+	const char *name;
+	unsigned char opcode;
+	const char *schema;
+	char repeat;
+	char framed;
+	char action;
+} CommandSyntax;
+
+// Sorted by name, so the names sharing a first char are adjacent
+static const CommandSyntax command_syntaxes[] = {
+	{"end", COMMAND_END, "", 0, 0, 0},
+	{"g", COMMAND_GO, "", 0, 1, 1},
+	{"headless", COMMAND_HEADLESS, "", 0, 1, 0},
+	{"mem", COMMAND_MEMORY, "", 0, 1, 0},
+	{"off", COMMAND_RULE_OFF, "s", 1, 1, 1},
+	{"on", COMMAND_RULE, "se", 0, 0, 0},
+	{"q", COMMAND_QUIT, "", 0, 1, 0},
+	{"rec", COMMAND_RECORD, "", 0, 0, 0},
+	{"replay", COMMAND_REPLAY, "", 0, 0, 0},
+	{"route", COMMAND_ROUTE, "ss", 0, 1, 1},
+	{"rv", COMMAND_REVERSE, "t", 1, 1, 1},
+	{"s", COMMAND_STOP, "", 0, 1, 1},
+	{"script", COMMAND_SCRIPT, "", 0, 0, 0},
+	{"sensors", COMMAND_SENSOR_WINDOW, "n", 0, 1, 0},
+	{"sw", COMMAND_SWITCH, "wd", 1, 1, 1},
+	{"tr", COMMAND_TRAIN, "tn", 1, 1, 1},
+	{"trace", COMMAND_TRACE, "", 0, 1, 0},
+	{"ui", COMMAND_UI, "", 0, 1, 0},
+};
+
+#define COMMAND_SYNTAX_TOTAL (sizeof(command_syntaxes) / sizeof(CommandSyntax))
+
+// Index of the first syntax of each first char, -1 if none
+static signed char command_dispatch[COMMAND_NAME_LAST - COMMAND_NAME_FIRST + 1];
+
+// Index of the syntax of each opcode, -1 if none
+static signed char command_opcodes[COMMAND_OPCODE_TOTAL];
+
+void commandBootstrap() {
+	int i;
+	for(i = 0; i <= COMMAND_NAME_LAST - COMMAND_NAME_FIRST; i++) command_dispatch[i] = -1;
+	for(i = 0; i < COMMAND_OPCODE_TOTAL; i++) command_opcodes[i] = -1;
+	for(i = COMMAND_SYNTAX_TOTAL - 1; i >= 0; i--) {
+		command_dispatch[command_syntaxes[i].name[0] - COMMAND_NAME_FIRST] = i;
+		command_opcodes[command_syntaxes[i].opcode] = i;
+	}
+}
+
+static inline int isDelimiter(char c) {
+	return c == '\0' || c == ' ' || c == '\n' || c == '\r';
+}
+
+static inline const char *skipSpaces(const char *str) {
+	while(*str == ' ') str++;
+	return str;
+}
+
+// Return: the syntax named by the first token of *str, 0 if none. *str is moved to the first operand
+static const CommandSyntax *findSyntax(const char **str) {
+	const char *input = *str;
+	if(*input < COMMAND_NAME_FIRST || *input > COMMAND_NAME_LAST) return 0;
+	int i = command_dispatch[*input - COMMAND_NAME_FIRST];
+	if(i < 0) return 0;
+
+	for(; i < COMMAND_SYNTAX_TOTAL && command_syntaxes[i].name[0] == *input; i++) {
+		const char *name = command_syntaxes[i].name + 1;
+		const char *str_char = input + 1;
+		while(*name != '\0' && *name == *str_char) name++, str_char++;
+		if(*name == '\0' && isDelimiter(*str_char)) {
+			*str = skipSpaces(str_char);
+			return &command_syntaxes[i];
+		}
+	}
+	return 0;
+}
+
+static inline int validOperand(char kind, int value) {
+	switch(kind) {
+		case 'n':
+			return value >= 0 && value <= COMMAND_NUMBER_MAX;
+		case 't':
+			return TRAIN_NUMBER_VALID(value);
+		case 'w':
+			return TRACK_SWITCH_VALID(value);
+		case 'd':
+			return value == TRACK_DIR_STRAIGHT || value == TRACK_DIR_CURVED;
+		case 's':
+			return value >= 0 && value < TRACK_SENSOR_TOTAL;
+		default:
+			return 0;
+	}
+}
+
+// Return: address of the next operand, 0 if the operand is invalid
+static const char *parseOperand(const char *str, char kind, unsigned char *operand) {
+	int value = 0;
+	const char *start = str;
+	switch(kind) {
+		case 'n':
+		case 't':
+		case 'w':
+			while(*str >= '0' && *str <= '9') {
+				value = value * 10 + (*str++ - '0');
+				if(value > COMMAND_NUMBER_MAX) return 0;
+			}
+			if(str == start || !validOperand(kind, value)) return 0;
+			break;
+		case 'd':
+			if(*str == 'S') value = TRACK_DIR_STRAIGHT;
+			else if(*str == 'C') value = TRACK_DIR_CURVED;
+			else return 0;
+			str++;
+			break;
+		case 's':
+			value = trackSensorIndex(str);
+			if(value == TRACK_NONE) return 0;
+			while(!isDelimiter(*str)) str++;
+			break;
+		default:
+			return 0;
+	}
+	if(!isDelimiter(*str)) return 0;
+	*operand = value;
+	return skipSpaces(str);
+}
+
+// Return: 1 if the word, ended by a delimiter or ':', is at *str, which is moved past it
+static int matchWord(const char **str, const char *word) {
+	const char *input = *str;
+	while(*word != '\0' && *word == *input) word++, input++;
+	if(*word != '\0' || !(isDelimiter(*input) || *input == ':')) return 0;
+	*str = skipSpaces(input);
+	return 1;
+}
+
+// The operands of syntax, at input, into record
+static int parseRecord(const char *input, const CommandSyntax *syntax, CommandRecord *record) {
+	record->opcode = syntax->opcode;
+	record->count = 0;
+	while(syntax->schema[0] != '\0' && !isDelimiter(*input)) {
+		if(record->count == COMMAND_OPERANDS_MAX) return -1;
+		unsigned char *operand = record->operands[record->count];
+		const char *kind = syntax->schema;
+		operand[1] = 0;
+		for(; *kind != '\0'; kind++, operand++) {
+			input = parseOperand(input, *kind, operand);
+			if(input == 0) return -1;
+		}
+		record->count++;
+		if(!syntax->repeat) break;
+	}
+
+	// Nothing should follow, and a command with operands needs at least one
+	if(!isDelimiter(*input)) return -1;
+	if(syntax->schema[0] != '\0' && record->count == 0) return -1;
+	return 1;
+}
+
+/*
+ * "on <sensor> [rising|falling][:] <command>", rising if no edge is given.
+ * The rule goes into record[0], its action into record[1]: one of the
+ * commands commandRuleAction() allows, never another rule.
+ */
+static int parseRule(const char *input, CommandRecord *record) {
+	char name[4];
+	int i;
+	for(i = 0; i < sizeof(name) - 1 && !isDelimiter(input[i]) && input[i] != ':'; i++) name[i] = input[i];
+	if(!isDelimiter(input[i]) && input[i] != ':') return -1;
+	name[i] = '\0';
+	int sensor = trackSensorIndex(name);
+	if(sensor == TRACK_NONE) return -1;
+
+	input = skipSpaces(input + i);
+	int edge = COMMAND_EDGE_RISING;
+	if(matchWord(&input, "falling")) edge = COMMAND_EDGE_FALLING;
+	else matchWord(&input, "rising");
+	if(*input == ':') input = skipSpaces(input + 1);
+
+	record->opcode = COMMAND_RULE;
+	record->count = 1;
+	record->operands[0][0] = sensor;
+	record->operands[0][1] = edge;
+
+	const CommandSyntax *action = findSyntax(&input);
+	if(action == 0 || !action->action) return -1;
+	return parseRecord(input, action, record + 1) == 1 ? 2 : -1;
+}
+
+int commandParse(const char *input, CommandRecord *record) {
+	const CommandSyntax *syntax = findSyntax(&input);
+	if(syntax == 0) return -1;
+	if(syntax->opcode == COMMAND_RULE) return parseRule(input, record);
+	return parseRecord(input, syntax, record);
+}
+
+int commandRuleAction(unsigned char opcode) {
+	return opcode < COMMAND_OPCODE_TOTAL && command_opcodes[opcode] >= 0 && command_syntaxes[(int)command_opcodes[opcode]].action;
+}
+
+int commandDecode(const unsigned char *payload, unsigned int size, CommandRecord *records, unsigned int max) {
+	const unsigned char *end = payload + size;
+	unsigned int total = 0;
+	int i;
+	while(payload != end) {
+		if(total == max || end - payload < 2) return -1;
+		if(payload[0] >= COMMAND_OPCODE_TOTAL || command_opcodes[payload[0]] < 0) return -1;
+		const CommandSyntax *syntax = &command_syntaxes[(int)command_opcodes[payload[0]]];
+		if(!syntax->framed) return -1;
+
+		// Same operand counts as a parsed command
+		CommandRecord *record = &records[total++];
+		record->opcode = payload[0];
+		record->count = payload[1];
+		payload += 2;
+		if(syntax->schema[0] == '\0' ? record->count != 0 : record->count == 0) return -1;
+		if(record->count > (syntax->repeat ? COMMAND_OPERANDS_MAX : 1)) return -1;
+		if(end - payload < record->count * 2) return -1;
+
+		for(i = 0; i < record->count; i++, payload += 2) {
+			record->operands[i][0] = payload[0];
+			record->operands[i][1] = syntax->schema[1] != '\0' ? payload[1] : 0;
+			if(!validOperand(syntax->schema[0], payload[0])) return -1;
+			if(syntax->schema[1] != '\0' && !validOperand(syntax->schema[1], payload[1])) return -1;
+		}
+	}
+	return total;
+}
@@ -0,0 +1,73 @@
+/*
+ * command.h - table driven parser of user commands into binary records
+ */
+
+#ifndef __COMMAND_H__
+#define __COMMAND_H__
+
+#define COMMAND_GO 1
+#define COMMAND_STOP 2
+#define COMMAND_QUIT 3
+#define COMMAND_TRAIN 4
+#define COMMAND_REVERSE 5
+#define COMMAND_SWITCH 6
+#define COMMAND_ROUTE 7
+#define COMMAND_SCRIPT 8
+#define COMMAND_END 9
+#define COMMAND_RECORD 10
+#define COMMAND_REPLAY 11
+#define COMMAND_MEMORY 12
+#define COMMAND_TRACE 13
+#define COMMAND_HEADLESS 14
+#define COMMAND_UI 15
+#define COMMAND_RULE 16
+#define COMMAND_RULE_OFF 17
+#define COMMAND_SENSOR_WINDOW 18
+#define COMMAND_OPCODE_TOTAL 19
+
+#define COMMAND_OPERANDS_MAX 8
+#define COMMAND_PARSED_MAX 2	// Records of one line, a rule and its action
+
+#define COMMAND_EDGE_RISING 0
+#define COMMAND_EDGE_FALLING 1
+
+/*
+ * Fixed-size binary form of a command, shared by every input source.
+ * Each operand is a pair:
+ * 	COMMAND_TRAIN	(train, speed)
+ * 	COMMAND_REVERSE	(train, 0)
+ * 	COMMAND_SWITCH	(switch, TRACK_DIR_STRAIGHT or TRACK_DIR_CURVED)
+ * 	COMMAND_ROUTE	(from sensor, to sensor) as track node index
+ * 	COMMAND_RULE	(sensor, COMMAND_EDGE_*), followed by the record of its action
+ * 	COMMAND_RULE_OFF	(sensor, 0)
+ * 	COMMAND_SENSOR_WINDOW	(sensor requests in flight, 0)
+ */
+typedef struct CommandRecord {
+	unsigned char opcode;
+	unsigned char count;
+	unsigned char operands[COMMAND_OPERANDS_MAX][2];
+} CommandRecord;
+
+void commandBootstrap();
+
+/*
+ * Parse one line of user input, e.g. "tr 35 10 48 5" or "sw 5 C 6 S", or a
+ * rule, e.g. "on A5 rising: sw 12 C" or "on C13: tr 48 0"
+ * Return: records parsed into record[], 2 for a rule and its action,
+ *         -1 Invalid command
+ */
+int commandParse(const char *input, CommandRecord *record);
+
+// Return: 1 if a command of opcode may be the action of a rule: g, s, tr, rv, sw, route or off
+int commandRuleAction(unsigned char opcode);
+
+/*
+ * Decode the operations of a binary command frame. Each is the opcode, the
+ * operand count, then a pair of bytes per operand as in CommandRecord; the
+ * second byte is ignored for one byte operands. Operands are checked as
+ * commandParse() does, sensors are sent as track node index.
+ * Return: operations decoded into records, -1 Malformed or invalid frame
+ */
+int commandDecode(const unsigned char *payload, unsigned int size, CommandRecord *records, unsigned int max);
+
+#endif // __COMMAND_H__
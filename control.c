@@ -0,0 +1,825 @@
+/*
+ * control.c - the control core: train command queue, sensor polling,
+ * switches, routes and the clock, without any screen output
+ */
+
+#include <plio.h>
+#include <ts7200.h>
+#include <hal.h>
+#include <trace.h>
+#include <track.h>
+#include <train.h>
+#include <command.h>
+#include <rule.h>
+#include <control.h>
+
+#define FALSE 0x00000000
+#define TRUE 0xffffffff
+
+/* Timer Constants */
+#define TIMER_MIN 0x00000000
+#define TIMER_MAX 0xffffffff
+#define TIMER_CLOCK_TICK 20
+#define TIMER_ADJUST_PERIOD 3000
+#define TIMER_ADJUST_TICK 5
+#define DEBUG_TIMER_US_NUMERATOR 1000
+#define DEBUG_TIMER_US_DENOMINATOR 983
+
+/* Train Control */
+#define SYSTEM_START 96
+#define SYSTEM_STOP 97
+#define SYSTEM_OPERAND_MAX 31	// Speed and function bytes [0 - 31] are followed by a train number
+
+#define TRAIN_COMMAND_PAUSE_TIMEOUT 25
+#define TRAIN_COMMAND_DELAY 3
+
+#define SWITCH_STR 33
+#define SWITCH_CUR 34
+#define SWITCH_OFF 32
+#define SWITCH_NAMING_BASE 1
+#define SWITCH_NAMING_MAX 18
+#define SWITCH_NAMING_MID_BASE 153
+#define SWITCH_NAMING_MID_MAX 156
+
+#define SENSOR_AUTO_RESET 192
+#define SENSOR_READ_ONE 192
+#define SENSOR_READ_MULTI 128
+#define SENSOR_BIT_MASK 0x01
+#define SENSOR_READ(command) ((unsigned char)(command) > SENSOR_READ_ONE && (unsigned char)(command) <= SENSOR_READ_ONE + SENSOR_DECODER_TOTAL)
+#define SENSOR_REQUEST_DELAY 0
+#define SENSOR_REQUEST_TIMEOUT TRAIN_COMMAND_PAUSE_TIMEOUT
+#define SENSOR_RESYNC_TICKS 3	// Longer than a reply on the wire
+#define SENSOR_DRAIN_TIME 9830	// Debug timer ticks the bootstrap drains COM1 at most, 10ms
+#define SENSOR_WINDOW_DEFAULT 1
+
+/* Global Variable Declarations */
+
+static const ControlHandlers control_no_handlers = { 0, 0, 0, 0 };
+static const ControlHandlers *control_handlers = &control_no_handlers;
+
+// Clock, queue indices and sensor polling: everything a pass of the loop goes through
+ControlLoop control_loop;
+
+// Timings of the queue and the sensor polling, see controlTune; the window is kept in sensor_window
+static ControlTuning control_tuning = { TRAIN_COMMAND_DELAY, TRAIN_COMMAND_PAUSE_TIMEOUT, SENSOR_REQUEST_TIMEOUT, SENSOR_WINDOW_DEFAULT };
+
+// Train Commands
+TrainCommand train_commands_buffer[TRAIN_COMMAND_BUFFER_MAX] = {};
+unsigned int train_commands_pushed = 0;
+unsigned int train_commands_dropped = 0;
+unsigned int train_commands_rejected = 0;
+
+// Group of commands being written, see reserveTrainCommands
+static unsigned int train_reserve_lane = TRAIN_LANE_ROUTINE;
+static unsigned int train_reserve_index = 0;	// Slot of the next command put
+static unsigned int train_reserve_count = 0;
+
+// Rule lane, and the sensor byte arrival of the first command of each action, for the latency
+TrainCommand rule_commands_buffer[RULE_COMMAND_BUFFER_MAX] = {};
+unsigned int rule_commands_arrived[RULE_COMMAND_BUFFER_MAX] = {};
+
+// Buffer and size of each lane, by TRAIN_LANE_*
+static TrainCommand *const train_lane_buffers[TRAIN_LANE_TOTAL] = { train_commands_buffer, rule_commands_buffer };
+static const unsigned short train_lane_sizes[TRAIN_LANE_TOTAL] = { TRAIN_COMMAND_BUFFER_MAX, RULE_COMMAND_BUFFER_MAX };
+char rule_commands_timed[RULE_COMMAND_BUFFER_MAX] = {};
+
+// Rules
+unsigned int rules_fired = 0;
+unsigned int rules_dropped = 0;
+unsigned int rule_latency_last = 0;
+unsigned int rule_latency_max = 0;
+unsigned int rule_latency_total = 0;
+unsigned int rule_latency_count = 0;
+
+// COM1: urgent commands sent ahead of the queue
+unsigned int com1_urgent = 0;
+
+int switch_ids[SWITCH_TOTAL] = {};
+char switch_states[SWITCH_TOTAL] = {};
+
+// Route
+static ControlRoute control_route;
+unsigned int route_started_tick = 0;
+unsigned int route_pending_index = TRAIN_COMMAND_BUFFER_MAX;
+unsigned int route_pending_lane = TRAIN_LANE_ROUTINE;
+
+// Sensor Data
+char sensor_decoder_data[SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH] = {};
+unsigned int sensor_byte_arrived = 0;	// Debug timer at the arrival of the last byte
+
+// Sensor requests in flight, oldest first, by decoder; their count is in control_loop
+unsigned char sensor_requested[SENSOR_WINDOW_MAX] = {};
+unsigned int sensor_requested_first = 0;
+unsigned int sensor_request_decoder = 0;	// Asked for next
+unsigned int sensor_window = SENSOR_WINDOW_DEFAULT;
+int sensor_resync = 0;	// Quiet ticks left before requesting again, after a timeout
+unsigned int sensor_sweeps = 0;	// Replies of the last decoder
+unsigned int sensor_timeouts = 0;
+unsigned int sensor_stray = 0;	// Bytes not asked for, dropped
+unsigned int sensor_drained = 0;	// Left over on COM1 at the bootstrap
+unsigned int sensor_stale = 0;	// Requests still queued at a timeout, dropped unsent
+/*
+ * Decoder + 1 of the request that left the queue, 0 once the controller took
+ * it: CTS dropped after it was on the wire, or its reply began. The UART takes
+ * the next byte while the last is shifting out, before CTS drops, and the
+ * controller drops a reply if asked again while it is still polling.
+ */
+unsigned char sensor_request_sent = 0;
+
+/*
+ * Hardware Register Manipulation
+ */
+
+int getRegister(int base, int offset) {
+	return HAL_READ(HAL_REG(base, offset));
+}
+
+int getRegisterBit(int base, int offset, int mask) {
+	return (getRegister(base, offset)) & mask;
+}
+
+void setRegister(int base, int offset, int value) {
+	HAL_WRITE(HAL_REG(base, offset), value);
+}
+
+void setRegisterBit(int base, int offset, int mask, int value) {
+	int buf = getRegister(base, offset);
+	buf = value ? buf | mask : buf & ~mask;
+	setRegister(base, offset, buf);
+}
+
+/*
+ * Timer Control
+ */
+
+unsigned int setTimerControl(int timer_base, unsigned int enable, unsigned int mode, unsigned int clksel) {
+	HalReg timer_control_addr = HAL_REG(timer_base, CRTL_OFFSET);
+	unsigned int control_value = (ENABLE_MASK & enable) | (MODE_MASK & mode) | (CLKSEL_MASK & clksel) ;
+	TRACE(TRACE_TIMER_CONTROL, timer_base, control_value);
+
+	HAL_WRITE(timer_control_addr, control_value);
+	return HAL_READ(timer_control_addr);
+}
+
+void setDebugTimer(unsigned int enable) {
+	setRegisterBit(TIMER4_VALUE_HI, 0, TIMER4_ENABLE_MASK, enable);
+}
+
+unsigned int getDebugTimerValue() {
+	return getRegister(TIMER4_VALUE_LO, 0);
+}
+
+unsigned int getTimerValue(int timer_base) {
+	unsigned int value = HAL_READ(HAL_REG(timer_base, VAL_OFFSET));
+	return value;
+}
+
+unsigned int handleTimeElapse() {
+	unsigned int timer_value = getTimerValue(TIMER3_BASE);
+	unsigned int time_elapsed = control_loop.timer_previous - timer_value;
+
+	// Fix time_elapsed when underflow
+	if(timer_value > control_loop.timer_previous) {
+		time_elapsed = control_loop.timer_previous + (TIMER_MAX - timer_value) + 1;
+	}
+
+	// If time elapsed more than 1/100 sec
+	if(time_elapsed >= TIMER_CLOCK_TICK)
+	{
+		// Add elapsed time into remaining ticks, then convert to 1/100 sec
+		unsigned int remained = control_loop.timer_remained + time_elapsed;
+		unsigned int tick_elapsed = remained / TIMER_CLOCK_TICK;
+		control_loop.timer_remained = remained % TIMER_CLOCK_TICK;
+		control_loop.tick += tick_elapsed;
+		control_loop.timer_previous = timer_value;
+
+		// if(control_loop.tick % TIMER_ADJUST_PERIOD == 0) control_loop.tick += TIMER_ADJUST_TICK;
+
+		return tick_elapsed;
+	}
+
+	return 0;
+}
+
+/*
+ * Train Control
+ */
+
+// Framer of COM1, for plio: 1 while a speed or switch byte waits for its train or switch number
+unsigned int frameTrainCommand(unsigned int state, char c) {
+	unsigned char command = c;
+	if(state > 0) return 0;
+	return (command <= SYSTEM_OPERAND_MAX || command == SWITCH_STR || command == SWITCH_CUR) ? 1 : 0;
+}
+
+// Send a one byte command ahead of the train command queue, as soon as the command being sent is complete
+void sendUrgentCommand(char command) {
+	plsetlane(COM1, PLLANE_INTERACTIVE);
+	plputc(COM1, command);
+	plsetlane(COM1, PLLANE_BULK);
+	TRACE(TRACE_COM1_URGENT, command, 0);
+	com1_urgent++;
+	if(control_handlers->com1) control_handlers->com1();
+}
+
+/*
+ * Reserve room for a group of commands in the lane being pushed to, the only
+ * check for room the group gets. Its commands are then written by
+ * putTrainCommand, and popped only once commitTrainCommands publishes them.
+ */
+int reserveTrainCommands(unsigned int count) {
+	train_reserve_lane = control_loop.lane;
+	train_reserve_index = control_loop.save_index[train_reserve_lane];
+	if(count > trainCommandsFree()) {
+		TRACE(TRACE_TRAIN_FULL, count, trainCommandsFree());
+		train_commands_rejected++;
+		train_commands_dropped += count;
+		train_reserve_count = 0;
+		return 0;
+	}
+	train_reserve_count = count;
+	return 1;
+}
+
+void putTrainCommand(char command, int delay, int pause) {
+	TrainCommand *slot = &train_lane_buffers[train_reserve_lane][train_reserve_index];
+	slot->command = command;
+	slot->delay = delay;
+	slot->pause = pause;
+	TRACE(TRACE_TRAIN_PUSH, command, delay);
+	if(++train_reserve_index == train_lane_sizes[train_reserve_lane]) train_reserve_index = 0;
+}
+
+void commitTrainCommands() {
+	control_loop.save_index[train_reserve_lane] = train_reserve_index;
+	train_commands_pushed += train_reserve_count;
+	train_reserve_count = 0;
+}
+
+int pushTrainCommand(char command, int delay, int pause) {
+	if(!reserveTrainCommands(1)) return 0;
+	putTrainCommand(command, delay, pause);
+	commitTrainCommands();
+	return 1;
+}
+
+unsigned int trainCommandsFree() {
+	unsigned int lane = control_loop.lane, size = train_lane_sizes[lane];
+	return (control_loop.send_index[lane] + size - control_loop.save_index[lane] - 1) % size;
+}
+
+static void ruleCommandSent(unsigned int index) {
+	unsigned int latency = (getDebugTimerValue() - rule_commands_arrived[index]) * DEBUG_TIMER_US_NUMERATOR / DEBUG_TIMER_US_DENOMINATOR;
+	rule_commands_timed[index] = 0;
+	rule_latency_last = latency;
+	if(latency > rule_latency_max) rule_latency_max = latency;
+	rule_latency_total += latency;
+	rule_latency_count++;
+	TRACE(TRACE_RULE_SENT, rule_commands_buffer[index].command, latency);
+	if(control_handlers->rule) control_handlers->rule();
+}
+
+int popTrainCommand(unsigned int tick_elapsed) {
+	// Commands wait here, not in plio, so that an urgent command is at most one command behind
+	if(plchpending(plchannel(COM1), PLLANE_BULK) > 0) return -1;
+
+	if(control_loop.pause_time > 0) {
+		if(tick_elapsed > 0) {
+			control_loop.pause_time -= tick_elapsed;
+		}
+		else return -1;
+
+		if(control_loop.pause_time <= 0) TRACE(TRACE_TRAIN_RESUME, control_loop.pause_time, 0);
+	}
+
+	// The rule lane first, but the lane of a command being sent completes it
+	unsigned int lane = control_loop.frame != 0 ? control_loop.sent_lane : (control_loop.send_index[TRAIN_LANE_RULE] != control_loop.save_index[TRAIN_LANE_RULE] ? TRAIN_LANE_RULE : TRAIN_LANE_ROUTINE);
+	TrainCommand *buffer = train_lane_buffers[lane];
+	unsigned short *send_index = &control_loop.send_index[lane];
+
+	if(*send_index != control_loop.save_index[lane]) {
+		char command = buffer[*send_index].command;
+		if(SENSOR_READ(command) && sensor_stale > 0) {
+			// Given up with those in flight, its decoder is asked for again
+			sensor_stale--;
+			*send_index = (*send_index + 1) % train_lane_sizes[lane];
+			return 0;
+		}
+		if(SENSOR_READ(command) && sensor_request_sent) return -1;	// Would overlap the last one
+
+		int delay = buffer[*send_index].delay;
+		if(delay > 0 && tick_elapsed > 0) {
+			delay -= tick_elapsed;
+			buffer[*send_index].delay = delay;
+		}
+
+		if(delay <= 0) {
+			unsigned int next_index = (*send_index + 1) % train_lane_sizes[lane];
+			control_loop.pause_time = buffer[*send_index].pause;
+
+			TRACE(TRACE_TRAIN_SEND, command, control_loop.pause_time);
+			plputc(COM1, command);
+			control_loop.frame = frameTrainCommand(control_loop.frame, command);
+			if(SENSOR_READ(command)) {
+				// Timed from here, not from the queue, unless an earlier one is still unanswered
+				if(control_loop.sensor_outstanding - --control_loop.sensor_queued == 1) control_loop.sensor_request_time = 0;
+				sensor_request_sent = (unsigned char)command - SENSOR_READ_ONE;
+			}
+			control_loop.sent_lane = lane;
+			if(lane == TRAIN_LANE_RULE && rule_commands_timed[*send_index]) ruleCommandSent(*send_index);
+
+			// Route is established once its solenoid-off is sent
+			if(*send_index == route_pending_index && lane == route_pending_lane) {
+				route_pending_index = TRAIN_COMMAND_BUFFER_MAX;
+				control_route.done = TRUE;
+				control_route.ticks = control_loop.tick - route_started_tick;
+				if(control_handlers->route) control_handlers->route(&control_route);
+			}
+
+			*send_index = next_index;
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Queue one speed byte for a train, for the sequences of train.c. Return: 1 Queued, 0 No room
+int sendTrainSpeed(char speed, char train) {
+	if(trainCommandsFree() < 2) return 0; // Sent again on a later poll, not a rejection
+	reserveTrainCommands(2);
+	putTrainCommand(speed, control_tuning.command_delay, FALSE);
+	putTrainCommand(train, FALSE, FALSE);
+	commitTrainCommands();
+	return 1;
+}
+
+static void setSwitchState(int index, char state) {
+	switch_states[index] = state;
+	if(control_handlers->switched) control_handlers->switched(index);
+}
+
+// Throw every switch on the path that is not already set, as one burst with a single solenoid-off
+int handleRouteCommand(int from, int to) {
+	TrackSwitchSetting settings[TRACK_ROUTE_MAX];
+	int count = trackRoute(from, to, settings);
+	if(count < 0) return COMMAND_RESULT_INVALID;
+
+	// The switches to throw, then the burst and its solenoid-off as one group
+	int i, thrown = 0;
+	for(i = 0; i < count; i++) {
+		char state = settings[i].direction == TRACK_DIR_CURVED ? 'C' : 'S';
+		if(switch_states[TRACK_SWITCH_INDEX(settings[i].id)] != state) thrown++;
+	}
+	if(thrown > 0 && !reserveTrainCommands(thrown * 2 + 1)) return COMMAND_RESULT_BUSY;
+
+	thrown = 0;
+	for(i = 0; i < count; i++) {
+		int index = TRACK_SWITCH_INDEX(settings[i].id);
+		char state = settings[i].direction == TRACK_DIR_CURVED ? 'C' : 'S';
+		if(switch_states[index] == state) continue;
+
+		putTrainCommand(state == 'S' ? SWITCH_STR : SWITCH_CUR, thrown == 0 ? control_tuning.command_delay : FALSE, FALSE);
+		putTrainCommand(settings[i].id, FALSE, FALSE);
+		setSwitchState(index, state);
+		thrown++;
+	}
+
+	control_route.from = from;
+	control_route.to = to;
+	control_route.switches = thrown;
+	control_route.done = thrown == 0;
+	control_route.ticks = 0;
+	route_started_tick = control_loop.tick;
+	route_pending_index = TRAIN_COMMAND_BUFFER_MAX;
+	if(thrown > 0) {
+		route_pending_index = train_reserve_index;
+		route_pending_lane = control_loop.lane;
+		putTrainCommand(SWITCH_OFF, control_tuning.command_delay, FALSE); // Turn off the solenoid once for the whole route
+		commitTrainCommands();
+	}
+	if(control_handlers->route) control_handlers->route(&control_route);
+
+	return COMMAND_RESULT_NORMAL;
+}
+
+int controlSubmit(const CommandRecord *record) {
+	int i;
+	const unsigned char *operand;
+	switch(record->opcode) {
+		case COMMAND_GO:
+			sendUrgentCommand(SYSTEM_START);
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_STOP:
+			sendUrgentCommand(SYSTEM_STOP);
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_TRAIN:
+			for(i = 0; i < record->count; i++) {
+				operand = record->operands[i];
+				trainSpeed(operand[0], operand[1], control_loop.tick);
+			}
+			return COMMAND_RESULT_NORMAL;
+		case COMMAND_REVERSE:
+			for(i = 0; i < record->count; i++) trainReverse(record->operands[i][0], control_loop.tick);
+			return COMMAND_RESULT_NORMAL;
+		case COMMAND_SWITCH:
+			// Throw every listed switch back-to-back, then turn off the solenoid once, all queued or none
+			if(!reserveTrainCommands(controlQueueCost(record))) return COMMAND_RESULT_BUSY;
+			for(i = 0; i < record->count; i++) {
+				operand = record->operands[i];
+				putTrainCommand(operand[1] == TRACK_DIR_CURVED ? SWITCH_CUR : SWITCH_STR, i == 0 ? control_tuning.command_delay : FALSE, FALSE);
+				putTrainCommand(operand[0], FALSE, FALSE);
+				setSwitchState(TRACK_SWITCH_INDEX(operand[0]), operand[1] == TRACK_DIR_CURVED ? 'C' : 'S');
+			}
+			putTrainCommand(SWITCH_OFF, control_tuning.command_delay, FALSE); // Turn off the solenoid
+			commitTrainCommands();
+			return COMMAND_RESULT_NORMAL;
+		case COMMAND_ROUTE:
+			if(!TRACK_ROUTE_ALLOWED) return COMMAND_RESULT_INVALID; // Placeholder layout, see track.h
+			return handleRouteCommand(record->operands[0][0], record->operands[0][1]);
+		case COMMAND_RULE:
+			if(!controlCheck(record)) return COMMAND_RESULT_INVALID;
+			if(!ruleAdd(record->operands[0][0], record->operands[0][1], &record[1])) return COMMAND_RESULT_INVALID;
+			if(control_handlers->rule) control_handlers->rule();
+			return COMMAND_RESULT_NORMAL;
+		case COMMAND_RULE_OFF:
+			for(i = 0; i < record->count; i++) ruleRemove(record->operands[i][0]);
+			if(control_handlers->rule) control_handlers->rule();
+			return COMMAND_RESULT_NORMAL;
+		case COMMAND_SENSOR_WINDOW:
+			return controlSensorWindow(record->operands[0][0]) ? COMMAND_RESULT_NORMAL : COMMAND_RESULT_INVALID;
+		default:
+			return COMMAND_RESULT_INVALID;
+	}
+}
+
+int controlCheck(const CommandRecord *record) {
+	TrackSwitchSetting settings[TRACK_ROUTE_MAX];
+	switch(record->opcode) {
+		case COMMAND_GO:
+		case COMMAND_STOP:
+		case COMMAND_TRAIN:
+		case COMMAND_REVERSE:
+		case COMMAND_SWITCH:
+		case COMMAND_RULE_OFF:
+			return 1;
+		case COMMAND_ROUTE:
+			return TRACK_ROUTE_ALLOWED && trackRoute(record->operands[0][0], record->operands[0][1], settings) >= 0;
+		case COMMAND_RULE:
+			return commandRuleAction(record[1].opcode) && controlQueueCost(&record[1]) < RULE_COMMAND_BUFFER_MAX;
+		case COMMAND_SENSOR_WINDOW:
+			return record->operands[0][0] >= 1 && record->operands[0][0] <= SENSOR_WINDOW_MAX;
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Run the action of a rule through the rule lane, all of it or nothing. Its
+ * first command goes without the delay it would have after routine ones.
+ */
+static void fireRule(const CommandRecord *action, unsigned int arrived) {
+	unsigned int first = control_loop.save_index[TRAIN_LANE_RULE];
+	control_loop.lane = TRAIN_LANE_RULE;
+	if(controlQueueCost(action) > trainCommandsFree()) {
+		control_loop.lane = TRAIN_LANE_ROUTINE;
+		rules_dropped++;
+		return;
+	}
+	controlSubmit(action);
+	control_loop.lane = TRAIN_LANE_ROUTINE;
+
+	if(first != control_loop.save_index[TRAIN_LANE_RULE]) {
+		rule_commands_buffer[first].delay = 0;
+		rule_commands_arrived[first] = arrived;
+		rule_commands_timed[first] = 1;
+	}
+	rules_fired++;
+	TRACE(TRACE_RULE_FIRE, action->opcode, control_loop.save_index[TRAIN_LANE_RULE] - first);
+	if(control_handlers->rule) control_handlers->rule();
+}
+
+unsigned int controlQueueCost(const CommandRecord *record) {
+	switch(record->opcode) {
+		case COMMAND_TRAIN:
+		case COMMAND_REVERSE:
+			return record->count * 2;
+		case COMMAND_SWITCH:
+			return record->count * 2 + 1;
+		case COMMAND_ROUTE:
+			return TRACK_ROUTE_MAX * 2 + 1;
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Sensor Data Collection
+ */
+
+void sensorBootstrap(){
+	PlChannel *com1 = plchannel(COM1);
+	int i;
+	for(i = 0; i < SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH; i++) sensor_decoder_data[i] = 0x00;
+	control_loop.sensor_next = 0;
+	control_loop.sensor_request_cts = 1;
+	control_loop.sensor_outstanding = 0;
+	control_loop.sensor_queued = 0;
+	sensor_requested_first = 0;
+	sensor_request_decoder = 0;
+	sensor_resync = 0;
+	sensor_sweeps = 0;
+	sensor_timeouts = 0;
+	sensor_stray = 0;
+	sensor_stale = 0;
+	sensor_request_sent = 0;
+
+	/*
+	 * One flag read per byte: plchgetc decides on the snapshot taken here.
+	 * A controller still talking would hold the boot up, so the drain stops
+	 * after SENSOR_DRAIN_TIME, what comes later is dropped as stray.
+	 */
+	unsigned int drain_started = getDebugTimerValue();
+	sensor_drained = 0;
+	plchinvalidate(com1);
+	while(!(plchstatus(com1) & RXFE_MASK) && getDebugTimerValue() - drain_started < SENSOR_DRAIN_TIME) {
+		char c;
+		if(plchgetc(com1, &c) > 0) {
+			TRACE(TRACE_SENSOR_FLUSH, c, 0);
+			sensor_drained++;
+		}
+	}
+	pushTrainCommand(SENSOR_AUTO_RESET, control_tuning.command_delay, FALSE);
+}
+
+int controlTune(const ControlTuning *tuning) {
+	if(tuning->command_delay < 0 || tuning->command_delay > CONTROL_TUNING_MAX) return 0;
+	if(tuning->sensor_pause < 1 || tuning->sensor_pause > CONTROL_TUNING_MAX) return 0;
+	if(tuning->sensor_timeout < 1 || tuning->sensor_timeout > CONTROL_TUNING_MAX) return 0;
+	if(!controlSensorWindow(tuning->sensor_window)) return 0;
+	control_tuning = *tuning;
+	return 1;
+}
+
+void controlTuning(ControlTuning *tuning) {
+	*tuning = control_tuning;
+	tuning->sensor_window = sensor_window;
+}
+
+int controlSensorWindow(unsigned int window) {
+	if(window < 1 || window > SENSOR_WINDOW_MAX) return 0;
+	sensor_window = window;
+	if(window > 1) control_loop.pause_time = 0;	// The pause of the request in flight
+	control_loop.sensor_request_cts = sensor_resync == 0 && control_loop.sensor_outstanding < window;
+	return 1;
+}
+
+// Both bytes of the oldest request are in
+void receivedSensorData() {
+	sensor_requested_first = (sensor_requested_first + 1) % SENSOR_WINDOW_MAX;
+	control_loop.sensor_outstanding--;
+	if(control_loop.sensor_outstanding > 0) control_loop.sensor_next = sensor_requested[sensor_requested_first] * SENSOR_BYTE_EACH;
+	control_loop.pause_time = 0;	// Only sensor requests pause, with a window of 1 or before it was widened
+	control_loop.sensor_request_cts = control_loop.sensor_outstanding < sensor_window;
+}
+
+/*
+ * CTS held low for PLSTALL_TICKS with a byte to send: stop re-requesting
+ * sensor data on timeout, which would only pile up requests. Once CTS is
+ * back, the request just sent gets a fresh pause to be answered.
+ */
+void handleCom1Stall(PlChannel *com1) {
+	unsigned int stalled = plchstalled(com1);
+	if(!control_loop.com1_stalled && stalled >= PLSTALL_TICKS) {
+		control_loop.com1_stalled = 1;
+		TRACE(TRACE_COM1_STALL, stalled, com1->stalls);
+		if(control_handlers->com1) control_handlers->com1();
+	}
+	else if(control_loop.com1_stalled && stalled == 0) {
+		control_loop.com1_stalled = 0;
+		control_loop.sensor_request_time = 0;
+		if(sensor_window == 1 && control_loop.sensor_outstanding > control_loop.sensor_queued) control_loop.pause_time = control_tuning.sensor_pause;
+		TRACE(TRACE_COM1_STALL, 0, com1->stalls);
+		if(control_handlers->com1) control_handlers->com1();
+	}
+}
+
+/*
+ * Ask for the next decoder. With a window of 1 the queue pauses until the
+ * reply is in, otherwise the following commands and requests go as soon as
+ * CTS lets them, and the replies are matched to the requests in order.
+ * With the queue full, nothing is taken down and the request is made again
+ * on a later pass.
+ */
+void requestSensorData(){
+	unsigned int decoder_index = sensor_request_decoder;
+	char command = SENSOR_READ_ONE + decoder_index + 1;
+	if(trainCommandsFree() == 0) return;	// Not counted as dropped, it is retried
+	if(!pushTrainCommand(command, SENSOR_REQUEST_DELAY, sensor_window == 1 ? control_tuning.sensor_pause : FALSE)) return;
+
+	unsigned int slot = (sensor_requested_first + control_loop.sensor_outstanding) % SENSOR_WINDOW_MAX;
+	sensor_requested[slot] = decoder_index;
+	if(control_loop.sensor_outstanding++ == 0) control_loop.sensor_next = decoder_index * SENSOR_BYTE_EACH;
+	control_loop.sensor_queued++;
+	control_loop.sensor_request_cts = control_loop.sensor_outstanding < sensor_window;
+	sensor_request_decoder = (decoder_index + 1) % SENSOR_DECODER_TOTAL;
+	TRACE(TRACE_SENSOR_REQUEST, command, control_loop.sensor_outstanding);
+}
+
+/*
+ * No byte for the sensor timeout: the requests in flight are lost. Bytes
+ * may still be on the way, and would be taken for the answer to the next
+ * request, so the next ones wait for SENSOR_RESYNC_TICKS of a quiet line,
+ * starting over from the decoder of the oldest request lost. Those still
+ * queued behind them are dropped when they come up.
+ */
+static void resyncSensorData() {
+	TRACE(TRACE_SENSOR_TIMEOUT, control_loop.sensor_request_time, control_loop.sensor_outstanding);
+	sensor_timeouts++;
+	sensor_request_decoder = sensor_requested[sensor_requested_first];
+	sensor_stale += control_loop.sensor_queued;
+	control_loop.sensor_outstanding = 0;
+	control_loop.sensor_queued = 0;
+	control_loop.sensor_request_time = 0;
+	control_loop.sensor_request_cts = 0;
+	sensor_request_sent = 0;
+	control_loop.pause_time = 0;
+	sensor_resync = SENSOR_RESYNC_TICKS;
+}
+
+void saveDecoderData(unsigned int decoder_index, char new_data) {
+	// Save to sensor_decoder_data
+	char old_data = sensor_decoder_data[decoder_index];
+	sensor_decoder_data[decoder_index] = new_data;
+
+	// Sensors newly tripped, and released, rules first
+	char tripped = new_data & ~old_data;
+	char released = old_data & ~new_data;
+	if(tripped | released) ruleDispatch(decoder_index, tripped, released, sensor_byte_arrived);
+	if(tripped == 0) return;
+
+	if(TRACE_ENABLED) {
+		int i;
+		for(i = 0; i < SENSOR_BYTE_SIZE; i++) {
+			if((tripped >> i) & SENSOR_BIT_MASK) TRACE(TRACE_SENSOR_HIT, 'A' + decoder_index / SENSOR_BYTE_EACH, SENSOR_NUMBER(decoder_index, i));
+		}
+	}
+	if(control_handlers->sensor) control_handlers->sensor(decoder_index, new_data, tripped);
+}
+
+void collectSensorData(int tick_elapsed) {
+	PlChannel *com1 = plchannel(COM1);
+	char new_data = '\0';
+
+	// On the snapshot of the pass: the request was written on an earlier one, with CTS up
+	if(sensor_request_sent && plchpending(com1, PLLANE_BULK) == 0 && !(plchstatus(com1) & (CTS_MASK | TXBUSY_MASK))) sensor_request_sent = 0;
+
+	if(plchgetc(com1, &new_data) > 0) {
+		if(control_loop.sensor_outstanding == 0) {
+			// Not asked for, or late while resynchronizing: the line is not quiet yet
+			TRACE(TRACE_SENSOR_FLUSH, new_data, 0);
+			sensor_stray++;
+			if(sensor_resync > 0) sensor_resync = SENSOR_RESYNC_TICKS;
+		}
+		else {
+			sensor_byte_arrived = getDebugTimerValue();
+			TRACE(TRACE_SENSOR_BYTE, control_loop.sensor_next, new_data);
+			control_loop.sensor_request_time = 0;
+			if(sensor_request_sent == control_loop.sensor_next / SENSOR_BYTE_EACH + 1) sensor_request_sent = 0;
+
+			// Save the data
+			saveDecoderData(control_loop.sensor_next, new_data);
+
+			// Increment the counter
+			control_loop.sensor_next++;
+
+			// If end receiving the reply to a request, clear to send another
+			if((control_loop.sensor_next % SENSOR_BYTE_EACH) == 0) {
+				if(control_loop.sensor_next == SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH) sensor_sweeps++;
+				receivedSensorData();
+			}
+		}
+	}
+
+	// Only a request on the wire is waited on, not one behind the queue
+	if(control_loop.sensor_outstanding > control_loop.sensor_queued && !control_loop.com1_stalled) {
+		control_loop.sensor_request_time += tick_elapsed;
+		if(control_loop.sensor_request_time > control_tuning.sensor_timeout) resyncSensorData();
+	}
+	if(sensor_resync > 0 && tick_elapsed > 0) {
+		sensor_resync -= tick_elapsed;
+		if(sensor_resync <= 0) {
+			sensor_resync = 0;
+			control_loop.sensor_request_cts = 1;
+		}
+	}
+
+	// Request for another chunk of data
+	if(control_loop.sensor_request_cts) requestSensorData();
+}
+
+/*
+ * Core API
+ */
+
+const ControlHandlers *controlSetHandlers(const ControlHandlers *handlers) {
+	const ControlHandlers *previous = control_handlers;
+	control_handlers = handlers != 0 ? handlers : &control_no_handlers;
+	return previous;
+}
+
+void controlBootstrap(const ControlHandlers *handlers) {
+	int i;
+	controlSetHandlers(handlers);
+
+	/* Initialize Elapsed time tracker */
+	control_loop.timer_previous = getTimerValue(TIMER3_BASE);
+	control_loop.timer_remained = 0;
+	control_loop.tick = 0;
+
+	/* Initialize Train Command Buffer */
+	for(i = 0; i < TRAIN_LANE_TOTAL; i++) {
+		control_loop.save_index[i] = 0;
+		control_loop.send_index[i] = 0;
+	}
+	control_loop.pause_time = 0;
+	train_commands_buffer[0].delay = 0;
+	control_loop.lane = TRAIN_LANE_ROUTINE;
+	control_loop.frame = 0;
+	control_loop.sent_lane = TRAIN_LANE_ROUTINE;
+	train_reserve_count = 0;
+	com1_urgent = 0;
+	control_loop.com1_stalled = 0;
+
+	/* Initialize Rules */
+	ruleBootstrap(fireRule);
+	rules_fired = 0;
+	rules_dropped = 0;
+	rule_latency_last = 0;
+	rule_latency_max = 0;
+	rule_latency_total = 0;
+	rule_latency_count = 0;
+
+	/* Initialize Track Graph, Train States and Switch States */
+	trackBootstrap();
+	trainBootstrap(sendTrainSpeed);
+	for(i = 0; i < SWITCH_TOTAL; i++) {
+		switch_ids[i] = i < SWITCH_NAMING_MAX ? i + SWITCH_NAMING_BASE : i + SWITCH_NAMING_MID_BASE - SWITCH_NAMING_MAX;
+		switch_states[i] = SWITCH_UNKNOWN;
+	}
+	route_pending_index = TRAIN_COMMAND_BUFFER_MAX;
+
+	/* Initialize Sensor Data Request */
+	sensorBootstrap();
+}
+
+unsigned int controlPoll() {
+	PlChannel *com1 = plchannel(COM1);
+
+	/* Polling IO: Give it a chance to send out char, on a fresh snapshot of the flags */
+	plchinvalidate(com1);
+	plchsend(com1);
+
+	/* Timer: Calculate time elapsed */
+	unsigned int tick_elapsed = handleTimeElapse();
+
+	/* Try to pop train commands from the buffer */
+	popTrainCommand(tick_elapsed);
+
+	/* Step the trains stopping, reversing or accelerating */
+	if(tick_elapsed > 0) {
+		trainPoll(control_loop.tick);
+		handleCom1Stall(com1);
+	}
+
+	/* Sensor: Collect data */
+	collectSensorData(tick_elapsed);
+
+	return tick_elapsed;
+}
+
+void controlStats(ControlStats *stats) {
+	PlChannel *com1 = plchannel(COM1);
+	stats->tick = control_loop.tick;
+	stats->queued = TRAIN_COMMAND_BUFFER_MAX - 1 - trainCommandsFree();
+	stats->pushed = train_commands_pushed;
+	stats->dropped = train_commands_dropped;
+	stats->rejected = train_commands_rejected;
+	stats->urgent = com1_urgent;
+	stats->stalls = com1->stalls;
+	stats->stall_max = com1->stall_max;
+	stats->stalled = control_loop.com1_stalled;
+	stats->rules = ruleTotal();
+	stats->rules_fired = rules_fired;
+	stats->rules_dropped = rules_dropped;
+	stats->rule_latency_last = rule_latency_last;
+	stats->rule_latency_max = rule_latency_max;
+	stats->rule_latency_mean = rule_latency_count > 0 ? rule_latency_total / rule_latency_count : 0;
+	stats->sensor_window = sensor_window;
+	stats->sensor_outstanding = control_loop.sensor_outstanding;
+	stats->sensor_sweeps = sensor_sweeps;
+	stats->sensor_timeouts = sensor_timeouts;
+	stats->sensor_stray = sensor_stray;
+	stats->sensor_drained = sensor_drained;
+}
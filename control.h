@@ -0,0 +1,261 @@
+/*
+ * control.h - the control core: train command queue, sensor polling,
+ * switches, routes and the clock, without any screen output
+ *
+ * The panel is one client of it: what the core does is reported through
+ * ControlHandlers, and the client draws it, frames it or ignores it. The
+ * host tools and benchmarks link the core alone, with no handler set.
+ */
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include <ts7200.h>
+#include <command.h>
+
+#define COMMAND_RESULT_INVALID -1
+#define COMMAND_RESULT_SYSTEM 1
+#define COMMAND_RESULT_NORMAL 2
+#define COMMAND_RESULT_QUIT 3
+#define COMMAND_RESULT_BUSY -2	// No room in the train command queue, nothing queued
+
+#define TRAIN_COMMAND_BUFFER_MAX 200
+#define RULE_COMMAND_BUFFER_MAX 64	// Room for a route
+
+#define TRAIN_LANE_ROUTINE 0
+#define TRAIN_LANE_RULE 1
+#define TRAIN_LANE_TOTAL 2
+
+#define SWITCH_TOTAL 22
+#define SWITCH_UNKNOWN '?'
+
+#define SENSOR_DECODER_TOTAL 5
+#define SENSOR_BYTE_EACH 2
+#define SENSOR_BYTE_SIZE 8
+#define SENSOR_WINDOW_MAX 4	// Sensor requests in flight at most, see controlSensorWindow
+
+#define CONTROL_TUNING_MAX 1000	// Longest delay, pause or timeout, in 1/100 sec
+
+// Number of a sensor in its decoder [1 - 16], from its decoder byte index and bit, LSB first
+#define SENSOR_NUMBER(index, bit) (SENSOR_BYTE_SIZE * ((index) % SENSOR_BYTE_EACH) + SENSOR_BYTE_SIZE - (bit))
+
+// Delay before it is sent and pause after, in 1/100 sec
+typedef struct TrainCommand {
+	short delay;
+	short pause;
+	char command;
+} TrainCommand;
+
+/*
+ * What every pass of the polling loop reads or writes, in the order of the
+ * pass: the clock, the queue, then the sensors. The counters and tables the
+ * loop only touches now and then stay out of it.
+ */
+typedef struct ControlLoop {
+	unsigned int tick;	// 1/100 sec since the bootstrap
+	unsigned int timer_previous;	// Timer3 value of the last tick
+	int pause_time;	// Before the next train command may be sent
+	int sensor_request_time;	// Waited on the sensor reply
+	unsigned short save_index[TRAIN_LANE_TOTAL];	// Train command queue, by lane
+	unsigned short send_index[TRAIN_LANE_TOTAL];
+	unsigned char timer_remained;	// Timer3 ticks short of a tick
+	unsigned char lane;	// Pushed to
+	unsigned char sent_lane;	// Of the last command sent
+	unsigned char frame;	// State of frameTrainCommand after the commands sent
+	unsigned char sensor_next;	// Decoder byte expected
+	unsigned char sensor_request_cts;	// 1 while another request may go
+	unsigned char sensor_outstanding;	// Requests not answered, queued or sent
+	unsigned char sensor_queued;	// Of those, still in the train command queue
+	unsigned char com1_stalled;	// 1 while the controller holds CTS low
+} ControlLoop;
+
+typedef struct ControlRoute {
+	int from;	// Sensors, as track node index
+	int to;
+	int switches;	// Thrown, the others were already set
+	int done;	// The solenoid-off has been sent
+	unsigned int ticks;	// From queueing to the solenoid-off, once done
+} ControlRoute;
+
+/*
+ * Called from controlPoll() and controlSubmit(), any of them may be 0
+ */
+typedef struct ControlHandlers {
+	void (*sensor)(unsigned int index, char data, char tripped);	// Decoder byte index, its data and the bits newly set, if any
+	void (*switched)(unsigned int index);	// Switch index, see switch_states
+	void (*route)(const ControlRoute *route);	// Once queued, then once done
+	void (*com1)();	// Urgent command sent, CTS stall started or over, see controlStats
+	void (*rule)();	// Rule added, removed, fired, or its first command sent, see controlStats
+} ControlHandlers;
+
+/*
+ * Timings of the queue and the sensor polling, in 1/100 sec. The defaults
+ * are the ones used on the track, the host sweeps try others.
+ */
+typedef struct ControlTuning {
+	int command_delay;	// Before a speed, switch throw, solenoid-off or auto reset leaves the queue
+	int sensor_pause;	// The queue waits that long at most on a sensor reply, with a window of 1
+	int sensor_timeout;	// No reply byte for longer, the requests in flight are lost
+	unsigned int sensor_window;	// See controlSensorWindow
+} ControlTuning;
+
+typedef struct ControlStats {
+	unsigned int tick;	// 1/100 sec since the bootstrap
+	unsigned int queued;	// Train commands waiting in the queue
+	unsigned int pushed;	// Train commands accepted and dropped (queue full)
+	unsigned int dropped;
+	unsigned int rejected;	// Groups of commands rejected whole, their commands are in dropped
+	unsigned int urgent;	// Urgent commands sent ahead of the queue
+	unsigned int stalls;	// CTS stalls of COM1, and the longest in Timer3 ticks
+	unsigned int stall_max;
+	int stalled;	// 1 while COM1 is stalled
+	unsigned int rules;	// Rules in the table
+	unsigned int rules_fired;	// Actions run, and dropped for lack of room in the rule lane
+	unsigned int rules_dropped;
+	unsigned int rule_latency_last;	// From the arrival of the sensor byte to the first command of the action leaving the queue, in us
+	unsigned int rule_latency_max;
+	unsigned int rule_latency_mean;
+	unsigned int sensor_window;	// Sensor requests allowed in flight, and in flight now
+	unsigned int sensor_outstanding;
+	unsigned int sensor_sweeps;	// Replies of the last decoder
+	unsigned int sensor_timeouts;	// Requests lost, each followed by a resynchronization
+	unsigned int sensor_stray;	// Bytes not asked for, dropped
+	unsigned int sensor_drained;	// Left over on COM1 at the bootstrap, flushed
+} ControlStats;
+
+extern ControlLoop control_loop;
+
+/*
+ * The queue has two lanes: the routine one, and the rule lane for the
+ * actions of rules, which goes first. The lanes only take turns between
+ * commands, a speed or switch byte is always followed by its number.
+ * Their indices are in control_loop.
+ */
+extern TrainCommand train_commands_buffer[TRAIN_COMMAND_BUFFER_MAX];
+
+// Commands accepted and dropped (queue full), and the groups they were dropped in, since boot
+extern unsigned int train_commands_pushed;
+extern unsigned int train_commands_dropped;
+extern unsigned int train_commands_rejected;
+
+extern TrainCommand rule_commands_buffer[RULE_COMMAND_BUFFER_MAX];
+
+// Ids, and 'S', 'C' or SWITCH_UNKNOWN, by switch index
+extern int switch_ids[SWITCH_TOTAL];
+extern char switch_states[SWITCH_TOTAL];
+
+extern char sensor_decoder_data[SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH];
+
+/*
+ * Reset the clock, the queue, the trains, switches and sensors, then flush
+ * COM1 for 10ms at most and ask for sensor auto reset. Timer3 and the debug
+ * timer must be running, COM1 set up.
+ */
+void controlBootstrap(const ControlHandlers *handlers);
+
+// Return: the handlers replaced
+const ControlHandlers *controlSetHandlers(const ControlHandlers *handlers);
+
+/*
+ * One cycle of the polling loop for the core: send on COM1, advance the
+ * clock, send the next train command, step the trains and poll the sensors
+ * Return: ticks elapsed since the last call
+ */
+unsigned int controlPoll();
+
+/*
+ * Run a go, stop, tr, rv, sw, route, on, off or sensors record. The record of an on
+ * is followed by the record of its action, one of the others but on.
+ * Return: COMMAND_RESULT_*, COMMAND_RESULT_INVALID for the other opcodes,
+ * COMMAND_RESULT_BUSY if the queue has no room for a sw or route
+ */
+int controlSubmit(const CommandRecord *record);
+
+/*
+ * Whether controlSubmit would run a record, without running it: a route
+ * needs a path, a sensors window must be in range. Room in the queue is
+ * not checked, see controlQueueCost.
+ * Return: 1 Runs, 0 COMMAND_RESULT_INVALID
+ */
+int controlCheck(const CommandRecord *record);
+
+/*
+ * Sensor requests kept in flight, [1 - SENSOR_WINDOW_MAX]. With 1, the
+ * queue pauses after each request until its reply is in. With more, the
+ * following requests go as soon as CTS lets them, keeping COM1 busy
+ * during the turnaround of the controller.
+ * Return: 1 Set, 0 Out of range
+ */
+int controlSensorWindow(unsigned int window);
+
+/*
+ * Apply all the timings at once, from the next command queued
+ * Return: 1 Set, 0 A value out of range, nothing changed
+ */
+int controlTune(const ControlTuning *tuning);
+
+void controlTuning(ControlTuning *tuning);
+
+// Train command queue slots a record takes at most, see trainCommandsFree
+unsigned int controlQueueCost(const CommandRecord *record);
+
+void controlStats(ControlStats *stats);
+
+// Framer of COM1, see plsetframer
+unsigned int frameTrainCommand(unsigned int state, char c);
+
+/*
+ * Train command queue
+ */
+
+/*
+ * A group of commands, e.g. a speed byte and its train number, is queued
+ * whole or not at all: reserve room for count commands, put each of them,
+ * then commit. Nothing is popped before the commit, and nothing may be
+ * pushed in between.
+ * Return: 1 Reserved, 0 No room, the group is rejected
+ */
+int reserveTrainCommands(unsigned int count);
+
+void putTrainCommand(char command, int delay, int pause);
+
+void commitTrainCommands();
+
+// A group of one command. Return: 1 Queued, 0 No room
+int pushTrainCommand(char command, int delay, int pause);
+
+int popTrainCommand(unsigned int tick_elapsed);
+
+// Room left in the lane being pushed to, the routine one but while a rule fires
+unsigned int trainCommandsFree();
+
+int sendTrainSpeed(char speed, char train);
+
+/*
+ * Sensors
+ */
+
+void sensorBootstrap();
+
+void saveDecoderData(unsigned int decoder_index, char new_data);
+
+/*
+ * Registers and timers
+ */
+
+int getRegister(int base, int offset);
+
+int getRegisterBit(int base, int offset, int mask);
+
+void setRegister(int base, int offset, int value);
+
+void setRegisterBit(int base, int offset, int mask, int value);
+
+unsigned int setTimerControl(int timer_base, unsigned int enable, unsigned int mode, unsigned int clksel);
+
+void setDebugTimer(unsigned int enable);
+
+// Free running 983kHz counter, for measuring short durations
+unsigned int getDebugTimerValue();
+
+#endif // __CONTROL_H__
@@ -0,0 +1,93 @@
+/*
+ * cachesim.c - data cache simulation of the host build, for where valgrind
+ * is not available
+ *
+ * The sources are compiled with -fsanitize=thread, which makes gcc call
+ * __tsan_read and __tsan_write on each load and store of the program's own
+ * code (not of libc). Those calls are taken here, instead of by the thread
+ * sanitizer runtime, and fed to a model of the ARM920T data cache: 16 KB,
+ * 64 ways, lines of CACHE_LINE_SIZE, LRU. The counts are printed on exit.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <ts7200.h>
+
+#define CACHESIM_SIZE (16 * 1024)
+#define CACHESIM_WAYS 64
+#define CACHESIM_SETS (CACHESIM_SIZE / CACHE_LINE_SIZE / CACHESIM_WAYS)
+
+// Line address held by each way, most recently used first
+static uintptr_t cachesim_lines[CACHESIM_SETS][CACHESIM_WAYS];
+static unsigned long long cachesim_reads = 0, cachesim_writes = 0;
+static unsigned long long cachesim_read_misses = 0, cachesim_write_misses = 0;
+
+// Return: 1 on a miss
+static int cachesimLine( uintptr_t line ) {
+	uintptr_t *set = cachesim_lines[(line / CACHE_LINE_SIZE) % CACHESIM_SETS];
+	int i;
+	for(i = 0; i < CACHESIM_WAYS - 1 && set[i] != line; i++);
+	int miss = set[i] != line;
+	for(; i > 0; i--) set[i] = set[i - 1];
+	set[0] = line;
+	return miss;
+}
+
+// An access across two lines counts once, as a miss if either line missed
+static void cachesimAccess( void *address, unsigned int size, int write ) {
+	uintptr_t first = (uintptr_t)address & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+	uintptr_t last = ((uintptr_t)address + size - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+	int miss = cachesimLine(first);
+	if(last != first) miss |= cachesimLine(last);
+	if(write) {
+		cachesim_writes++;
+		cachesim_write_misses += miss;
+	}
+	else {
+		cachesim_reads++;
+		cachesim_read_misses += miss;
+	}
+}
+
+__attribute__((destructor)) static void cachesimReport() {
+	fprintf(stderr, "D1 (%u KB, %u ways, %u B lines): reads %llu, misses %llu; writes %llu, misses %llu\n",
+		CACHESIM_SIZE / 1024, CACHESIM_WAYS, CACHE_LINE_SIZE,
+		cachesim_reads, cachesim_read_misses, cachesim_writes, cachesim_write_misses);
+}
+
+/*
+ * Entry points of the instrumented code
+ */
+
+#define CACHESIM_READ(size) \
+	void __tsan_read##size( void *address ) { cachesimAccess(address, size, 0); } \
+	void __tsan_unaligned_read##size( void *address ) { cachesimAccess(address, size, 0); }
+#define CACHESIM_WRITE(size) \
+	void __tsan_write##size( void *address ) { cachesimAccess(address, size, 1); } \
+	void __tsan_unaligned_write##size( void *address ) { cachesimAccess(address, size, 1); }
+
+void __tsan_read1( void *address ) { cachesimAccess(address, 1, 0); }
+void __tsan_write1( void *address ) { cachesimAccess(address, 1, 1); }
+CACHESIM_READ(2)
+CACHESIM_READ(4)
+CACHESIM_READ(8)
+CACHESIM_READ(16)
+CACHESIM_WRITE(2)
+CACHESIM_WRITE(4)
+CACHESIM_WRITE(8)
+CACHESIM_WRITE(16)
+
+void __tsan_read_range( void *address, unsigned long size ) {
+	unsigned long i;
+	for(i = 0; i < size; i += CACHE_LINE_SIZE) cachesimAccess((char *)address + i, 1, 0);
+}
+
+void __tsan_write_range( void *address, unsigned long size ) {
+	unsigned long i;
+	for(i = 0; i < size; i += CACHE_LINE_SIZE) cachesimAccess((char *)address + i, 1, 1);
+}
+
+void __tsan_init() {}
+void __tsan_func_entry( void *caller ) {}
+void __tsan_func_exit( void ) {}
+void __tsan_vptr_update( void *address, void *value ) {}
@@ -0,0 +1,156 @@
+/*
+ * check.c - checks of the parser and the control core on the host build
+ *
+ * Each check prints its name and fails the run if its condition is false.
+ * Links the core alone, as the benchmarks' _core cases do, with the
+ * simulated peripherals on a virtual clock.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <plio.h>
+#include <track.h>
+#include <command.h>
+#include <control.h>
+#include <rule.h>
+#include "host/host.h"
+
+static char check_plio_buffer[CHANNEL_COUNT * OUTPUT_BUFFER_SIZE];
+static int check_failed = 0;
+
+static void check( const char *name, int passed ) {
+	printf("%-48s %s\n", name, passed ? "ok" : "FAILED");
+	if(!passed) check_failed++;
+}
+
+// Queue emptied but for the sensor auto reset, no rule, no train in a sequence
+static void checkReset() {
+	controlBootstrap(0);
+}
+
+static unsigned int laneQueued( int lane ) {
+	unsigned int size = lane == TRAIN_LANE_RULE ? RULE_COMMAND_BUFFER_MAX : TRAIN_COMMAND_BUFFER_MAX;
+	return (control_loop.save_index[lane] + size - control_loop.send_index[lane]) % size;
+}
+
+/*
+ * Rules
+ */
+
+static void checkRuleParse() {
+	CommandRecord record[COMMAND_PARSED_MAX + 1];
+	memset(record, 0xaa, sizeof(record));
+	check("on: nested on rejected", commandParse("on A1: on A2: on A3: sw 12 C", record) == -1);
+	check("on: nested on writes two records at most", record[COMMAND_PARSED_MAX].opcode == 0xaa);
+	check("on: q rejected as an action", commandParse("on A5: q", record) == -1);
+	check("on: script rejected as an action", commandParse("on A5: script", record) == -1);
+	check("on: mem rejected as an action", commandParse("on A5 falling: mem", record) == -1);
+	check("on: sw taken as an action", commandParse("on A5 falling: sw 12 C", record) == 2 && record[1].opcode == COMMAND_SWITCH);
+	check("on: off taken as an action", commandParse("on A5: off B3", record) == 2 && record[1].opcode == COMMAND_RULE_OFF);
+}
+
+static void checkRuleSubmit() {
+	CommandRecord record[COMMAND_PARSED_MAX];
+	checkReset();
+	record[0].opcode = COMMAND_RULE;
+	record[0].count = 1;
+	record[0].operands[0][0] = 0;
+	record[0].operands[0][1] = COMMAND_EDGE_RISING;
+	record[1].opcode = COMMAND_HEADLESS;
+	record[1].count = 0;
+	check("controlSubmit: headless rejected as an action", controlSubmit(record) == COMMAND_RESULT_INVALID && ruleTotal() == 0);
+	record[1].opcode = COMMAND_RULE_OFF;
+	record[1].count = 1;
+	record[1].operands[0][0] = 0;
+	check("controlSubmit: off of its own sensor rejected", controlSubmit(record) == COMMAND_RESULT_INVALID && ruleTotal() == 0);
+}
+
+// A1 turns off the rules of A2 on the same byte, A2's rule must not fire from the stale chain
+static void checkRuleRemovedWhileFiring() {
+	CommandRecord record[COMMAND_PARSED_MAX];
+	checkReset();
+	check("rules: A1 turns A2 off", commandParse("on A1: off A2", record) == 2 && controlSubmit(record) == COMMAND_RESULT_NORMAL);
+	check("rules: A1 throws 12", commandParse("on A1: sw 12 C", record) == 2 && controlSubmit(record) == COMMAND_RESULT_NORMAL);
+	check("rules: A2 throws 13", commandParse("on A2: sw 13 C", record) == 2 && controlSubmit(record) == COMMAND_RESULT_NORMAL);
+	saveDecoderData(0, 0x80);
+	check("rules: A1 fired, A2 left", ruleTotal() == 2 && laneQueued(TRAIN_LANE_RULE) == 3);
+	saveDecoderData(0, 0xc0);
+	check("rules: A2 removed, nothing more fired", ruleTotal() == 2 && laneQueued(TRAIN_LANE_RULE) == 3);
+}
+
+// A train ramping in the routine lane keeps its steps there when a rule fires for another
+static void checkRuleLane() {
+	CommandRecord record[COMMAND_PARSED_MAX];
+	checkReset();
+	check("lanes: tr 1 14 queued", commandParse("tr 1 14", record) == 1 && controlSubmit(record) == COMMAND_RESULT_NORMAL);
+	check("lanes: on A1: tr 2 4", commandParse("on A1: tr 2 4", record) == 2 && controlSubmit(record) == COMMAND_RESULT_NORMAL);
+	unsigned int routine = laneQueued(TRAIN_LANE_ROUTINE);
+	control_loop.tick += 100; // Train 1 is due for its next ramp step
+	saveDecoderData(0, 0x80);
+	check("lanes: only train 2 in the rule lane", laneQueued(TRAIN_LANE_RULE) == 2);
+	check("lanes: train 1 not stepped by the rule", laneQueued(TRAIN_LANE_ROUTINE) == routine);
+}
+
+/*
+ * Sensors
+ */
+
+static void pollTicks( unsigned int ticks ) {
+	unsigned int started = control_loop.tick;
+	while(control_loop.tick - started < ticks) controlPoll();
+}
+
+// A read queued behind the speeds of 16 trains is not timed until it is sent, nothing answers it here
+static void checkSensorTimeoutQueued() {
+	CommandRecord record[COMMAND_PARSED_MAX];
+	ControlStats stats;
+	char line[16];
+	int train;
+	checkReset();
+	for(train = 1; train <= 16; train++) {
+		sprintf(line, "tr %d 14", train);
+		commandParse(line, record);
+		controlSubmit(record);
+	}
+	pollTicks(40);
+	controlStats(&stats);
+	check("sensors: read behind the queue not timed", stats.sensor_timeouts == 0 && stats.sensor_outstanding == 1);
+	pollTicks(50);
+	controlStats(&stats);
+	check("sensors: read sent and unanswered timed out", stats.sensor_timeouts == 1);
+}
+
+/*
+ * Command frames
+ */
+
+// What a frame is checked with before any of its operations runs
+static void checkSubmitCheck() {
+	CommandRecord record[COMMAND_PARSED_MAX];
+	checkReset();
+	check("controlCheck: route with a path", commandParse("route A5 C13", record) == 1 && controlCheck(record));
+	check("controlCheck: route without a path", commandParse("route A2 C13", record) == 1 && !controlCheck(record));
+	check("controlCheck: route without a path queues nothing", controlSubmit(record) == COMMAND_RESULT_INVALID && laneQueued(TRAIN_LANE_ROUTINE) == 1);
+	check("controlCheck: sensors window out of range", commandParse("sensors 9", record) == 1 && !controlCheck(record));
+	check("controlCheck: q is not the core's", commandParse("q", record) == 1 && !controlCheck(record));
+}
+
+int main( int argc, char *argv[] ) {
+	HalUartConfig uart = { 16, 2000000000 };
+	halSetClock(100);
+	halConfigure(COM1, &uart);
+	halConfigure(COM2, &uart);
+	plbootstrap(check_plio_buffer);
+	commandBootstrap();
+	setTimerControl(TIMER3_BASE, ENABLE_MASK, 0, 0);	// The ticks of controlPoll, free running at 2kHz
+
+	checkRuleParse();
+	checkRuleSubmit();
+	checkRuleRemovedWhileFiring();
+	checkRuleLane();
+	checkSensorTimeoutQueued();
+	checkSubmitCheck();
+
+	printf("%d failed\n", check_failed);
+	return check_failed > 0;
+}
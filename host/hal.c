@@ -0,0 +1,367 @@
+/*
+ * hal.c - simulated TS-7200 register map for the host build
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <ts7200.h>
+#include <hal.h>
+#include <bwio.h>
+#include "host.h"
+
+#define HAL_UART_TOTAL 2
+#define HAL_QUEUE_MAX 4096
+#define HAL_UART_CLOCK 7372800ULL
+#define HAL_UART_FIFO_DEPTH 16
+#define HAL_TIMER_SLOW_HZ 2000ULL
+#define HAL_TIMER_FAST_HZ 508469ULL
+#define HAL_DEBUG_TIMER_HZ 983040ULL
+#define HAL_TIMER_FREE_RUN 0xffffffffU
+
+typedef struct HalQueue {
+	char data[HAL_QUEUE_MAX];
+	unsigned int head;
+	unsigned int count;
+} HalQueue;
+
+typedef struct HalUart {
+	unsigned int base;
+	int lcrh, lcrm, lcrl, ctlr;
+	int cts;
+	HalUartConfig config;
+	HalPeer *peer;
+	void (*tap)( char c, HalTime start );
+
+	HalQueue tx;	// Written by the board, the first byte is in the shift register
+	HalTime tx_done;	// Time the first byte is sent
+	HalQueue rx;	// Arrived, waiting to be read by the board
+	HalQueue wire;	// Sent by the peer, still on the line
+	HalTime wire_done;	// Time the first byte arrives
+
+	unsigned long long tx_total, rx_total, overruns;
+	unsigned long long flag_reads;
+} HalUart;
+
+typedef struct HalTimer {
+	unsigned int load, control, stopped_value;
+	HalTime started;
+} HalTimer;
+
+// As initialized by RedBoot: 115,200 bps, 8 bits, no parity, fifos enabled
+static HalUart hal_uarts[HAL_UART_TOTAL] = {
+	{ .base = UART1_BASE, .lcrh = WLEN_MASK | FEN_MASK, .lcrl = 0x3, .cts = 1, .config = { HAL_UART_FIFO_DEPTH, 0 } },
+	{ .base = UART2_BASE, .lcrh = WLEN_MASK | FEN_MASK, .lcrl = 0x3, .cts = 1, .config = { HAL_UART_FIFO_DEPTH, 0 } },
+};
+static HalTimer hal_timer3 = { .stopped_value = HAL_TIMER_FREE_RUN };
+static int hal_debug_timer_enabled = 0;
+static HalTime hal_debug_timer_started = 0;
+
+static HalTime hal_access_cost = 0;
+static HalTime hal_virtual_time = 0;
+static struct timespec hal_start;
+static int hal_started = 0;
+static HalTime hal_time_limit = 0;
+static void (*hal_time_limit_hook)() = 0;
+static void (*hal_timer_start_hook)() = 0;
+
+static unsigned long long hal_reads = 0;
+static unsigned long long hal_writes = 0;
+
+/*
+ * Byte queues
+ */
+
+static void queuePush( HalQueue *queue, char c ) {
+	queue->data[(queue->head + queue->count) % HAL_QUEUE_MAX] = c;
+	queue->count++;
+}
+
+static char queuePop( HalQueue *queue ) {
+	char c = queue->data[queue->head];
+	queue->head = (queue->head + 1) % HAL_QUEUE_MAX;
+	queue->count--;
+	return c;
+}
+
+/*
+ * Clock
+ */
+
+void halSetClock( HalTime access_cost ) {
+	hal_access_cost = access_cost;
+}
+
+HalTime halNow() {
+	if(hal_access_cost > 0) return hal_virtual_time;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(!hal_started) {
+		hal_start = now;
+		hal_started = 1;
+	}
+	return (HalTime)(now.tv_sec - hal_start.tv_sec) * HAL_NS_PER_SEC + now.tv_nsec - hal_start.tv_nsec;
+}
+
+void halSetTimeLimit( HalTime limit, void (*hook)() ) {
+	hal_time_limit = limit;
+	hal_time_limit_hook = hook;
+}
+
+void halOnTimerStart( void (*hook)() ) {
+	hal_timer_start_hook = hook;
+}
+
+/*
+ * UARTs
+ */
+
+static HalUart *halUart( int channel ) {
+	return (channel >= 0 && channel < HAL_UART_TOTAL) ? &hal_uarts[channel] : 0;
+}
+
+static int halFifoDepth( HalUart *uart ) {
+	return (uart->lcrh & FEN_MASK) ? uart->config.fifo_depth : 1;
+}
+
+static HalTime halUartFrameTime( HalUart *uart ) {
+	HalTime baud = uart->config.baud;
+	if(baud == 0) baud = HAL_UART_CLOCK / (16 * (((uart->lcrm & BRDH_MASK) << 8 | (uart->lcrl & BRDL_MASK)) + 1));
+	HalTime bits = 1 + 5 + ((uart->lcrh & WLEN_MASK) >> 5) + ((uart->lcrh & STP2_MASK) ? 2 : 1) + ((uart->lcrh & PEN_MASK) ? 1 : 0);
+	return bits * HAL_NS_PER_SEC / baud;
+}
+
+HalTime halFrameTime( int channel ) {
+	return halUartFrameTime(halUart(channel));
+}
+
+void halConfigure( int channel, const HalUartConfig *config ) {
+	HalUart *uart = halUart(channel);
+	uart->config = *config;
+	if(uart->config.fifo_depth < 1) uart->config.fifo_depth = 1;
+	if(uart->config.fifo_depth > HAL_QUEUE_MAX - 1) uart->config.fifo_depth = HAL_QUEUE_MAX - 1;
+}
+
+void halAttach( int channel, HalPeer *peer ) {
+	halUart(channel)->peer = peer;
+}
+
+void halTap( int channel, void (*tap)( char c, HalTime start ) ) {
+	halUart(channel)->tap = tap;
+}
+
+void halTransmit( int channel, char c ) {
+	HalUart *uart = halUart(channel);
+	if(uart->wire.count >= HAL_QUEUE_MAX) {
+		uart->overruns++;
+		return;
+	}
+	if(uart->wire.count == 0) {
+		HalTime now = halNow();
+		if(uart->wire_done < now) uart->wire_done = now;
+		uart->wire_done += halUartFrameTime(uart);
+	}
+	queuePush(&uart->wire, c);
+}
+
+int halPending( int channel ) {
+	HalUart *uart = halUart(channel);
+	return uart->wire.count + uart->rx.count;
+}
+
+void halSetCts( int channel, int cts ) {
+	halUart(channel)->cts = cts;
+}
+
+static void halUartAdvance( HalUart *uart, HalTime now ) {
+	HalTime frame = halUartFrameTime(uart);
+
+	// Bytes written by the board leave one frame time apart
+	while(uart->tx.count > 0 && now >= uart->tx_done) {
+		char c = queuePop(&uart->tx);
+		uart->tx_total++;
+		if(uart->tap != 0) uart->tap(c, uart->tx_done - frame);
+		uart->tx_done += frame;
+		if(uart->peer != 0 && uart->peer->receive != 0) uart->peer->receive(uart->peer->context, c);
+	}
+
+	// Bytes sent by the peer arrive one frame time apart, and overrun a full FIFO
+	while(uart->wire.count > 0 && now >= uart->wire_done) {
+		char c = queuePop(&uart->wire);
+		uart->rx_total++;
+		if(uart->rx.count < halFifoDepth(uart)) queuePush(&uart->rx, c);
+		else uart->overruns++;
+		uart->wire_done += frame;
+	}
+
+	if(uart->peer != 0 && uart->peer->poll != 0) uart->peer->poll(uart->peer->context, now);
+}
+
+static int halUartRead( HalUart *uart, unsigned int offset ) {
+	int flags = 0;
+	switch(offset) {
+		case UART_DATA_OFFSET:
+			return uart->rx.count > 0 ? (unsigned char)queuePop(&uart->rx) : 0;
+		case UART_LCRH_OFFSET:
+			return uart->lcrh;
+		case UART_LCRM_OFFSET:
+			return uart->lcrm;
+		case UART_LCRL_OFFSET:
+			return uart->lcrl;
+		case UART_CTLR_OFFSET:
+			return uart->ctlr;
+		case UART_FLAG_OFFSET:
+			uart->flag_reads++;
+			if(uart->cts) flags |= CTS_MASK;
+			if(uart->tx.count > 0) flags |= TXBUSY_MASK;
+			if(uart->rx.count == 0) flags |= RXFE_MASK;
+			if(uart->tx.count > halFifoDepth(uart)) flags |= TXFF_MASK;
+			if(uart->rx.count >= halFifoDepth(uart)) flags |= RXFF_MASK;
+			if(uart->tx.count <= 1) flags |= TXFE_MASK;
+			return flags;
+		default:
+			return 0;
+	}
+}
+
+static void halUartWrite( HalUart *uart, unsigned int offset, int value ) {
+	switch(offset) {
+		case UART_DATA_OFFSET:
+			// Lost if the FIFO (or holding register) and the shift register are full
+			if(uart->tx.count > halFifoDepth(uart)) return;
+			if(uart->tx.count == 0) uart->tx_done = halNow() + halUartFrameTime(uart);
+			queuePush(&uart->tx, value & DATA_MASK);
+			break;
+		case UART_LCRH_OFFSET:
+			uart->lcrh = value;
+			break;
+		case UART_LCRM_OFFSET:
+			uart->lcrm = value;
+			break;
+		case UART_LCRL_OFFSET:
+			uart->lcrl = value;
+			break;
+		case UART_CTLR_OFFSET:
+			uart->ctlr = value;
+			break;
+	}
+}
+
+/*
+ * Timers
+ */
+
+static unsigned int halTimerValue( HalTimer *timer, HalTime now ) {
+	if(!(timer->control & ENABLE_MASK)) return timer->stopped_value;
+
+	HalTime hz = (timer->control & CLKSEL_MASK) ? HAL_TIMER_FAST_HZ : HAL_TIMER_SLOW_HZ;
+	HalTime ticks = (now - timer->started) * hz / HAL_NS_PER_SEC;
+	if(timer->control & MODE_MASK) return timer->load - (unsigned int)(ticks % ((HalTime)timer->load + 1));
+	return HAL_TIMER_FREE_RUN - (unsigned int)ticks;
+}
+
+static void halTimerWrite( HalTimer *timer, unsigned int offset, int value, HalTime now ) {
+	switch(offset) {
+		case LDR_OFFSET:
+			timer->load = value;
+			break;
+		case CRTL_OFFSET:
+			if((value & ENABLE_MASK) && !(timer->control & ENABLE_MASK)) {
+				timer->started = now;
+				timer->control = value;
+				if(hal_timer_start_hook != 0) hal_timer_start_hook();
+			}
+			else if(!(value & ENABLE_MASK) && (timer->control & ENABLE_MASK)) {
+				timer->stopped_value = halTimerValue(timer, now);
+			}
+			timer->control = value;
+			break;
+	}
+}
+
+static unsigned long long halDebugTimerValue( HalTime now ) {
+	if(!hal_debug_timer_enabled) return 0;
+	return (now - hal_debug_timer_started) * HAL_DEBUG_TIMER_HZ / HAL_NS_PER_SEC;
+}
+
+/*
+ * Register access
+ */
+
+static HalTime halTick() {
+	if(hal_access_cost > 0) hal_virtual_time += hal_access_cost;
+	HalTime now = halNow();
+
+	int i;
+	for(i = 0; i < HAL_UART_TOTAL; i++) halUartAdvance(&hal_uarts[i], now);
+
+	if(hal_time_limit > 0 && now > hal_time_limit && hal_time_limit_hook != 0) {
+		void (*hook)() = hal_time_limit_hook;
+		hal_time_limit_hook = 0;
+		hook();
+	}
+	return now;
+}
+
+int halRead( HalReg reg ) {
+	HalTime now = halTick();
+	hal_reads++;
+
+	int i;
+	for(i = 0; i < HAL_UART_TOTAL; i++) {
+		if(reg >= hal_uarts[i].base && reg < hal_uarts[i].base + UART_MDMCTL_OFFSET) return halUartRead(&hal_uarts[i], reg - hal_uarts[i].base);
+	}
+	switch(reg) {
+		case TIMER3_BASE + LDR_OFFSET:
+			return hal_timer3.load;
+		case TIMER3_BASE + VAL_OFFSET:
+			return halTimerValue(&hal_timer3, now);
+		case TIMER3_BASE + CRTL_OFFSET:
+			return hal_timer3.control;
+		case TIMER4_VALUE_LO:
+			return (unsigned int)halDebugTimerValue(now);
+		case TIMER4_VALUE_HI:
+			return ((halDebugTimerValue(now) >> 32) & 0xff) | (hal_debug_timer_enabled ? TIMER4_ENABLE_MASK : 0);
+		default:
+			return 0;
+	}
+}
+
+void halWrite( HalReg reg, int value ) {
+	HalTime now = halTick();
+	hal_writes++;
+
+	int i;
+	for(i = 0; i < HAL_UART_TOTAL; i++) {
+		if(reg >= hal_uarts[i].base && reg < hal_uarts[i].base + UART_MDMCTL_OFFSET) {
+			halUartWrite(&hal_uarts[i], reg - hal_uarts[i].base, value);
+			return;
+		}
+	}
+	if(reg >= TIMER3_BASE && reg <= TIMER3_BASE + CLR_OFFSET) {
+		halTimerWrite(&hal_timer3, reg - TIMER3_BASE, value, now);
+	}
+	else if(reg == TIMER4_VALUE_HI) {
+		if((value & TIMER4_ENABLE_MASK) && !hal_debug_timer_enabled) hal_debug_timer_started = now;
+		hal_debug_timer_enabled = (value & TIMER4_ENABLE_MASK) != 0;
+	}
+}
+
+void halMetrics( HostMetrics *metrics ) {
+	HalUart *uart = &hal_uarts[COM1];
+	HalTime now = halNow(), frame = halUartFrameTime(uart);
+	metrics->seconds = (double)now / HAL_NS_PER_SEC;
+	metrics->com1_tx = now > 0 ? (double)(uart->tx_total * frame) / now : 0.0;
+	metrics->com1_rx = now > 0 ? (double)(uart->rx_total * frame) / now : 0.0;
+}
+
+void halStat() {
+	int i;
+	HalTime now = halNow();
+	fprintf(stderr, "Simulated time: %llu.%06llus, register reads: %llu, writes: %llu\n",
+		now / HAL_NS_PER_SEC, (now % HAL_NS_PER_SEC) / HAL_NS_PER_US, hal_reads, hal_writes);
+	for(i = 0; i < HAL_UART_TOTAL; i++) {
+		HalUart *uart = &hal_uarts[i];
+		fprintf(stderr, "COM%d: sent %llu, received %llu, overruns %llu, flag reads %llu\n", i + 1, uart->tx_total, uart->rx_total, uart->overruns, uart->flag_reads);
+	}
+}
@@ -0,0 +1,110 @@
+/*
+ * host.h - simulated TS-7200 peripherals for the host build
+ *
+ * Backs the registers used through hal.h: UART1 (COM1), UART2 (COM2),
+ * Timer3 and the Timer4 debug timer.
+ */
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+// Simulated time, in nanoseconds
+typedef unsigned long long HalTime;
+
+#define HAL_NS_PER_US 1000ULL
+#define HAL_NS_PER_SEC 1000000000ULL
+
+/*
+ * The device at the other end of a UART's line
+ * 	receive:	a byte sent by the board has fully arrived
+ * 	poll:	the simulated time has advanced
+ */
+typedef struct HalPeer {
+	void (*receive)( void *context, char c );
+	void (*poll)( void *context, HalTime now );
+	void *context;
+} HalPeer;
+
+typedef struct HalUartConfig {
+	int fifo_depth;	// Depth of each FIFO while FEN is set; 1 otherwise
+	int baud;	// 0 to follow the divisor written by the board
+} HalUartConfig;
+
+/*
+ * Clock of the simulation. With an access cost of 0, simulated time is the
+ * wall-clock time since start; otherwise it only advances by the access cost
+ * on each register access, which makes runs deterministic.
+ */
+void halSetClock( HalTime access_cost );
+
+HalTime halNow();
+
+/*
+ * Call hook once the simulated time passes limit (0 for no limit)
+ */
+void halSetTimeLimit( HalTime limit, void (*hook)() );
+
+/*
+ * Call hook when the board enables Timer3
+ */
+void halOnTimerStart( void (*hook)() );
+
+void halConfigure( int channel, const HalUartConfig *config );
+
+void halAttach( int channel, HalPeer *peer );
+
+/*
+ * Send a byte from the peer to the board; it arrives one frame time after the previous one
+ */
+void halTransmit( int channel, char c );
+
+/*
+ * Call tap for each byte the board sends on the channel, with the time
+ * it started to leave the UART
+ */
+void halTap( int channel, void (*tap)( char c, HalTime start ) );
+
+/*
+ * Bytes sent by the peer and not yet read by the board
+ */
+int halPending( int channel );
+
+/*
+ * Drive the CTS line seen by the board, it stays high unless a peer drops it
+ */
+void halSetCts( int channel, int cts );
+
+/*
+ * Time to send one byte at the channel's current line settings
+ */
+HalTime halFrameTime( int channel );
+
+void halStat();
+
+/*
+ * Figures of a run, printed with -m as one CSV record under HOST_METRICS_HEADER,
+ * the way the sweep runner collects them
+ */
+typedef struct HostMetrics {
+	double seconds;	// Simulated
+	double com1_tx;	// Share of the time COM1 was sending, and receiving
+	double com1_rx;
+	unsigned long long sensor_reads;	// Taken by the controller, and the bytes it could not make sense of
+	unsigned long long invalid;
+	unsigned int sweeps;	// Replies of the last decoder, requests lost and train commands dropped (queue full), by the core
+	unsigned int timeouts;
+	unsigned int dropped;
+	unsigned long long trips;	// Sensors tripped by the trains, and the time to the reply byte carrying them, in ms
+	double sensor_latency_mean;
+	double sensor_latency_max;
+	unsigned int commands;	// Command bytes through the queue, and their wait from the push to leaving COM1, in ms
+	double command_p50;
+	double command_p99;
+	double command_max;
+} HostMetrics;
+
+#define HOST_METRICS_HEADER "seconds,com1_tx,com1_rx,sensor_reads,invalid,sweeps_per_sec,timeouts,dropped,trips,sensor_latency_mean_ms,sensor_latency_max_ms,commands,command_p50_ms,command_p99_ms,command_max_ms"
+
+void halMetrics( HostMetrics *metrics );
+
+#endif // __HOST_H__
@@ -0,0 +1,318 @@
+/*
+ * main.c - run the train control panel on the host, against simulated peripherals
+ *
+ * COM2 is the terminal: its output goes to stdout and stdin is typed into it.
+ * COM1 is the simulated Märklin controller, see marklin.h.
+ * In stress mode, COM2 is driven by the traffic generator of stress.h instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <ts7200.h>
+#include <plio.h>
+#include <control.h>
+#include "host.h"
+#include "marklin.h"
+#include "stress.h"
+
+#define TERMINAL_POLL_PERIOD (1000 * HAL_NS_PER_US)
+#define TERMINAL_PENDING_MAX 16
+#define STRESS_TIME_LIMIT 10
+
+int panelMain( int argc, char *argv[] );
+
+static struct termios terminal_saved;
+static int terminal_raw = 0;
+static HalTime terminal_polled = 0;
+static int terminal_eof = 0;
+
+static PlRecord *replay_records = 0;
+static unsigned int replay_count = 0;
+
+static int metrics_only = 0;
+
+/*
+ * Terminal on COM2
+ */
+
+static void terminalReceive( void *context, char c ) {
+	putchar(c);
+}
+
+static void terminalPoll( void *context, HalTime now ) {
+	if(now - terminal_polled < TERMINAL_POLL_PERIOD) return;
+	terminal_polled = now;
+	fflush(stdout);
+
+	// Type stdin into COM2, a few chars ahead of what the panel has read
+	char input[TERMINAL_PENDING_MAX];
+	int room = TERMINAL_PENDING_MAX - halPending(COM2);
+	if(terminal_eof || room <= 0) return;
+	int size = read(STDIN_FILENO, input, room);
+	if(size == 0) terminal_eof = 1;
+	int i;
+	for(i = 0; i < size; i++) halTransmit(COM2, input[i]);
+}
+
+static HalPeer terminal = { terminalReceive, terminalPoll, 0 };
+
+static void terminalRestore() {
+	if(terminal_raw) tcsetattr(STDIN_FILENO, TCSANOW, &terminal_saved);
+	terminal_raw = 0;
+}
+
+static void terminalOpen() {
+	if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &terminal_saved) == 0) {
+		struct termios raw = terminal_saved;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+		terminal_raw = 1;
+	}
+	fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+}
+
+/*
+ * Replay of a recording dumped by pldump()
+ */
+
+static int replayLoad( const char *path ) {
+	FILE *file = fopen(path, "r");
+	if(file == 0) return -1;
+
+	char word[16];
+	unsigned int size = 0;
+	while(fscanf(file, "%15s", word) == 1 && strcmp(word, "PLREC") != 0);
+	if(fscanf(file, "%u", &size) != 1 || size == 0) {
+		fclose(file);
+		return -1;
+	}
+
+	replay_records = calloc(size, sizeof(PlRecord));
+	while(replay_count < size && fscanf(file, "%15s", word) == 1 && strcmp(word, "PLREC") != 0) {
+		unsigned int value = strtoul(word, 0, 16);
+		PlRecord *record = &replay_records[replay_count++];
+		record->time = value >> 16;
+		record->flags = (value >> 8) & 0xff;
+		record->data = value & 0xff;
+	}
+	fclose(file);
+	return replay_count > 0 ? 0 : -1;
+}
+
+// Timer3 is the clock of a replay, start once the panel has enabled it
+static void replayStart() {
+	plreplay(replay_records, replay_count, 0, replay_count);
+}
+
+/*
+ * Main
+ */
+
+// Bytes plio wrote through to the UARTs, without waiting in a lane
+static void plioStat() {
+	int i;
+	for(i = 0; i < CHANNEL_COUNT; i++) {
+		PlChannel *ch = plchannel(i);
+		if(ch != 0) fprintf(stderr, "plio COM%d: sent %u, written through %u\n", i + 1, ch->total_send, ch->total_direct);
+	}
+}
+
+/*
+ * Tuning of the control core, KEY=VALUE[,KEY=VALUE...] over the defaults
+ * Return: 0 Applied, -1 Unknown key or value out of range
+ */
+static int tuneParse( const char *spec ) {
+	ControlTuning tuning;
+	char key[16];
+	int value, size;
+	controlTuning(&tuning);
+	while(sscanf(spec, "%15[a-z]=%d%n", key, &value, &size) == 2) {
+		if(strcmp(key, "delay") == 0) tuning.command_delay = value;
+		else if(strcmp(key, "pause") == 0) tuning.sensor_pause = value;
+		else if(strcmp(key, "timeout") == 0) tuning.sensor_timeout = value;
+		else if(strcmp(key, "window") == 0) tuning.sensor_window = value;
+		else return -1;
+		spec += size;
+		if(*spec == ',') spec++;
+		else break;
+	}
+	if(*spec != '\0') return -1;
+	return controlTune(&tuning) ? 0 : -1;
+}
+
+// One CSV record under HOST_METRICS_HEADER
+static void metricsPrint() {
+	HostMetrics metrics = { 0 };
+	ControlStats stats;
+	halMetrics(&metrics);
+	marklinMetrics(&metrics);
+	stressMetrics(&metrics);
+	controlStats(&stats);
+	metrics.sweeps = stats.sensor_sweeps;
+	metrics.timeouts = stats.sensor_timeouts;
+	metrics.dropped = stats.dropped;
+	fprintf(stderr, "%.3f,%.4f,%.4f,%llu,%llu,%.2f,%u,%u,%llu,%.2f,%.2f,%u,%.2f,%.2f,%.2f\n",
+		metrics.seconds, metrics.com1_tx, metrics.com1_rx, metrics.sensor_reads, metrics.invalid,
+		metrics.seconds > 0 ? metrics.sweeps / metrics.seconds : 0.0, metrics.timeouts, metrics.dropped,
+		metrics.trips, metrics.sensor_latency_mean, metrics.sensor_latency_max,
+		metrics.commands, metrics.command_p50, metrics.command_p99, metrics.command_max);
+}
+
+static void hostExit() {
+	fflush(stdout);
+	terminalRestore();
+	if(metrics_only) {
+		metricsPrint();
+		return;
+	}
+	halStat();
+	plioStat();
+	marklinStat();
+	stressStat();
+}
+
+static void timeLimitReached() {
+	exit(0);
+}
+
+static void usage( const char *name ) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -v, --virtual-clock NS   advance a virtual clock by NS per register access, instead of real time\n"
+		"  -t, --time-limit SEC     exit after SEC seconds of simulated time\n"
+		"  -f, --fifo-depth N       depth of the UART FIFOs while enabled (default 16)\n"
+		"  -1, --com1-baud BAUD     line speed of COM1 regardless of its divisor\n"
+		"  -2, --com2-baud BAUD     line speed of COM2 regardless of its divisor\n"
+		"  -c, --cts-hold US        the controller drops CTS for US microseconds after each byte (default 1000)\n"
+		"  -d, --reply-delay US     the controller answers a sensor read after US microseconds (default 5000)\n"
+		"  -x, --cts-stall AT:FOR   the controller holds CTS low for FOR ms from AT ms, e.g. 3000:2000\n"
+		"  -T, --train SPEC         place a simulated train, e.g. 58@A1 or 58@A1,C13,B16:10 (see host/marklin.h)\n"
+		"  -r, --replay FILE        replay the input of a recording dumped on quit\n"
+		"  -S, --stress SPEC        type RATE[:TRAINS[:TR,RV,SW]] random lines per second into COM2, e.g. 100:80:70,10,20\n"
+		"  -s, --seed N             seed of the stress lines (default 1)\n"
+		"  -k, --tune SPEC          timings of the core, e.g. delay=3,pause=25,timeout=25,window=1 (see ControlTuning)\n"
+		"  -m, --metrics            on exit, print one CSV record of " HOST_METRICS_HEADER " instead of the stats\n",
+		name);
+}
+
+int main( int argc, char *argv[] ) {
+	static const struct option options[] = {
+		{ "virtual-clock", required_argument, 0, 'v' },
+		{ "time-limit", required_argument, 0, 't' },
+		{ "fifo-depth", required_argument, 0, 'f' },
+		{ "com1-baud", required_argument, 0, '1' },
+		{ "com2-baud", required_argument, 0, '2' },
+		{ "cts-hold", required_argument, 0, 'c' },
+		{ "reply-delay", required_argument, 0, 'd' },
+		{ "cts-stall", required_argument, 0, 'x' },
+		{ "train", required_argument, 0, 'T' },
+		{ "replay", required_argument, 0, 'r' },
+		{ "stress", required_argument, 0, 'S' },
+		{ "seed", required_argument, 0, 's' },
+		{ "tune", required_argument, 0, 'k' },
+		{ "metrics", no_argument, 0, 'm' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	HalUartConfig com1 = { 16, 0 }, com2 = { 16, 0 };
+	MarklinConfig marklin = { MARKLIN_CTS_HOLD, MARKLIN_REPLY_DELAY, 0, 0 };
+	unsigned long long stall_at, stall_for;
+	StressConfig stress;
+	unsigned int seed = 1;
+	int stressed = 0, time_limited = 0;
+	int option;
+
+	while((option = getopt_long(argc, argv, "v:t:f:1:2:c:d:x:T:r:S:s:k:mh", options, 0)) != -1) {
+		switch(option) {
+			case 'v':
+				halSetClock(strtoull(optarg, 0, 10));
+				break;
+			case 't':
+				halSetTimeLimit((HalTime)(atof(optarg) * HAL_NS_PER_SEC), timeLimitReached);
+				time_limited = 1;
+				break;
+			case 'f':
+				com1.fifo_depth = com2.fifo_depth = atoi(optarg);
+				break;
+			case '1':
+				com1.baud = atoi(optarg);
+				break;
+			case '2':
+				com2.baud = atoi(optarg);
+				break;
+			case 'c':
+				marklin.cts_hold = strtoull(optarg, 0, 10) * HAL_NS_PER_US;
+				break;
+			case 'd':
+				marklin.reply_delay = strtoull(optarg, 0, 10) * HAL_NS_PER_US;
+				break;
+			case 'x':
+				if(sscanf(optarg, "%llu:%llu", &stall_at, &stall_for) != 2) {
+					fprintf(stderr, "Invalid CTS stall %s\n", optarg);
+					return 1;
+				}
+				marklin.stall_at = stall_at * 1000 * HAL_NS_PER_US;
+				marklin.stall_for = stall_for * 1000 * HAL_NS_PER_US;
+				break;
+			case 'T':
+				if(marklinAddTrain(optarg) < 0) {
+					fprintf(stderr, "Invalid train %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'r':
+				if(replayLoad(optarg) < 0) {
+					fprintf(stderr, "Unable to load recording from %s\n", optarg);
+					return 1;
+				}
+				halOnTimerStart(replayStart);
+				break;
+			case 'S':
+				if(stressParse(optarg, &stress) < 0) {
+					fprintf(stderr, "Invalid stress traffic %s\n", optarg);
+					return 1;
+				}
+				stressed = 1;
+				break;
+			case 's':
+				seed = strtoul(optarg, 0, 10);
+				break;
+			case 'k':
+				if(tuneParse(optarg) < 0) {
+					fprintf(stderr, "Invalid tuning %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'm':
+				metrics_only = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return option == 'h' ? 0 : 1;
+		}
+	}
+
+	halConfigure(COM1, &com1);
+	halConfigure(COM2, &com2);
+	marklinAttach(COM1, &marklin);
+	if(stressed) {
+		// No one to quit the panel
+		stress.seed = seed;
+		stressAttach(&stress);
+		if(!time_limited) halSetTimeLimit(STRESS_TIME_LIMIT * HAL_NS_PER_SEC, timeLimitReached);
+	}
+	else {
+		halAttach(COM2, &terminal);
+		terminalOpen();
+	}
+	atexit(hostExit);
+
+	return panelMain(0, 0);
+}
@@ -0,0 +1,372 @@
+/*
+ * marklin.c - simulated Märklin controller on COM1 for the host build
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <track.h>
+#include "marklin.h"
+
+#define MARKLIN_TRAIN_NUMBER_MAX 80
+#define MARKLIN_POLL_PERIOD (100 * HAL_NS_PER_US)
+#define MARKLIN_SOLENOID_LIMIT (500 * 1000 * HAL_NS_PER_US)
+
+/* Command bytes */
+#define MARKLIN_SPEED_MAX 14
+#define MARKLIN_REVERSE 15
+#define MARKLIN_FUNCTION 16
+#define MARKLIN_SOLENOID_OFF 32
+#define MARKLIN_SWITCH_STR 33
+#define MARKLIN_SWITCH_CUR 34
+#define MARKLIN_GO 96
+#define MARKLIN_STOP 97
+#define MARKLIN_RESET_OFF 128
+#define MARKLIN_READ_MULTI 128
+#define MARKLIN_RESET_ON 192
+#define MARKLIN_READ_ONE 192
+#define MARKLIN_BYTE_NONE -1
+
+/* Motion: every node to node segment has the same length */
+#define MARKLIN_SEGMENT_MM 300.0
+#define MARKLIN_MM_PER_SPEED 40.0
+
+typedef struct MarklinTrain {
+	int number;
+	int last;	// Last node passed
+	int next;	// Node ahead
+	double remaining;	// Distance to the node ahead, in mm
+	int waypoints[MARKLIN_WAYPOINT_MAX];
+	int waypoint_total;
+	int waypoint_next;
+	unsigned long long trips;
+} MarklinTrain;
+
+typedef struct MarklinStats {
+	unsigned long long bytes, commands, invalid;
+	unsigned long long speeds, reverses, switches, solenoid_offs, solenoid_overheats;
+	unsigned long long reads, reply_bytes, trips, ends;
+	unsigned long long latency_count;
+	HalTime latency_total, latency_max;
+} MarklinStats;
+
+static int marklin_channel = -1;
+static MarklinConfig marklin_config;
+static HalTime marklin_polled = 0;
+
+/* Command parsing */
+static int marklin_pending = MARKLIN_BYTE_NONE;
+static int marklin_busy = 0;
+static HalTime marklin_cts_until = 0;
+
+/* Controller state */
+static int marklin_go = 1;
+static int marklin_reset_mode = 0;
+static char marklin_speeds[MARKLIN_TRAIN_NUMBER_MAX + 1];
+static char marklin_switches[TRACK_SWITCH_TOTAL];
+static HalTime marklin_solenoid_on = 0;
+static int marklin_solenoid = 0;
+
+/* Decoders: latched bits and trip time of each sensor not yet reported */
+static unsigned char marklin_decoder_data[TRACK_DECODER_TOTAL * 2];
+static HalTime marklin_tripped[TRACK_SENSOR_TOTAL];
+
+/* Sensor read waiting to be answered */
+static int marklin_reply_first = 0;
+static int marklin_reply_count = 0;
+static HalTime marklin_reply_time = 0;
+
+static MarklinTrain marklin_trains[MARKLIN_TRAIN_MAX];
+static int marklin_train_total = 0;
+
+static MarklinStats marklin_stats;
+
+/*
+ * Track
+ */
+
+static int marklinFollow( int node ) {
+	const TrackNode *current = &track_nodes[node];
+	if(current->type == TRACK_NODE_BRANCH) return current->edge[(int)marklin_switches[TRACK_SWITCH_INDEX(current->id)]];
+	return current->edge[TRACK_DIR_AHEAD];
+}
+
+static void marklinThrowRoute( int from, int to ) {
+	TrackSwitchSetting settings[TRACK_ROUTE_MAX];
+	int i, count = trackRoute(from, to, settings);
+	for(i = 0; i < count; i++) marklin_switches[TRACK_SWITCH_INDEX(settings[i].id)] = settings[i].direction;
+}
+
+static void marklinTrip( int sensor, HalTime now ) {
+	// Sensor 1 of a decoder is the most significant bit of its first byte
+	int decoder = sensor / TRACK_DECODER_SENSORS, number = sensor % TRACK_DECODER_SENSORS;
+	marklin_decoder_data[decoder * 2 + number / 8] |= 0x80 >> (number % 8);
+	if(marklin_tripped[sensor] == 0) marklin_tripped[sensor] = now;
+	marklin_stats.trips++;
+}
+
+static void marklinPass( MarklinTrain *train, HalTime now ) {
+	if(track_nodes[train->last].type != TRACK_NODE_SENSOR) return;
+	marklinTrip(train->last, now);
+	train->trips++;
+
+	// Scripted route: head for the next waypoint
+	if(train->waypoint_total > 1 && train->last == train->waypoints[train->waypoint_next]) {
+		train->waypoint_next = (train->waypoint_next + 1) % train->waypoint_total;
+		marklinThrowRoute(train->last, train->waypoints[train->waypoint_next]);
+	}
+}
+
+static void marklinMove( MarklinTrain *train, double distance, HalTime now ) {
+	if(train->next == TRACK_NONE) return;
+	train->remaining -= distance;
+	while(train->remaining <= 0) {
+		train->last = train->next;
+		marklinPass(train, now);
+		train->next = marklinFollow(train->last);
+		if(train->next == TRACK_NONE) {
+			// End of the track, the train stays there
+			marklin_stats.ends++;
+			train->remaining = 0;
+			return;
+		}
+		train->remaining += MARKLIN_SEGMENT_MM;
+	}
+}
+
+static void marklinReverse( MarklinTrain *train ) {
+	int last = train->last;
+	if(train->next == TRACK_NONE) {
+		// Standing at the end of the track, right on its last node
+		train->next = track_nodes[last].reverse;
+		train->remaining = 0;
+		return;
+	}
+	train->last = track_nodes[train->next].reverse;
+	train->next = track_nodes[last].reverse;
+	train->remaining = MARKLIN_SEGMENT_MM - train->remaining;
+}
+
+/*
+ * Commands
+ */
+
+static void marklinTrainCommand( int command, int number ) {
+	if(number < 1 || number > MARKLIN_TRAIN_NUMBER_MAX) {
+		marklin_stats.invalid++;
+		return;
+	}
+	if((command & ~MARKLIN_FUNCTION) == MARKLIN_REVERSE) {
+		int i;
+		marklin_stats.reverses++;
+		for(i = 0; i < marklin_train_total; i++) {
+			if(marklin_trains[i].number == number) marklinReverse(&marklin_trains[i]);
+		}
+	}
+	else {
+		marklin_stats.speeds++;
+		marklin_speeds[number] = command & ~MARKLIN_FUNCTION;
+	}
+}
+
+static void marklinSwitchCommand( int command, int id, HalTime now ) {
+	if(!TRACK_SWITCH_VALID(id)) {
+		marklin_stats.invalid++;
+		return;
+	}
+	marklin_stats.switches++;
+	marklin_switches[TRACK_SWITCH_INDEX(id)] = command == MARKLIN_SWITCH_CUR ? TRACK_DIR_CURVED : TRACK_DIR_STRAIGHT;
+	if(!marklin_solenoid) marklin_solenoid_on = now;
+	marklin_solenoid = 1;
+}
+
+static void marklinSensorRead( int first, int count, HalTime now ) {
+	marklin_stats.reads++;
+	if(marklin_reply_count > 0) marklin_stats.invalid++; // Overlaps the previous read, which is dropped
+	marklin_reply_first = first;
+	marklin_reply_count = count;
+	marklin_reply_time = now + marklin_config.reply_delay;
+}
+
+static void marklinCommand( unsigned char c, HalTime now ) {
+	// Second byte of a train or switch command
+	if(marklin_pending != MARKLIN_BYTE_NONE) {
+		int command = marklin_pending;
+		marklin_pending = MARKLIN_BYTE_NONE;
+		marklin_stats.commands++;
+		if(command <= MARKLIN_REVERSE + MARKLIN_FUNCTION) marklinTrainCommand(command, c);
+		else marklinSwitchCommand(command, c, now);
+		return;
+	}
+
+	if(c <= MARKLIN_REVERSE + MARKLIN_FUNCTION || c == MARKLIN_SWITCH_STR || c == MARKLIN_SWITCH_CUR) {
+		marklin_pending = c;
+		return;
+	}
+
+	marklin_stats.commands++;
+	if(c == MARKLIN_SOLENOID_OFF) {
+		marklin_stats.solenoid_offs++;
+		if(marklin_solenoid && now - marklin_solenoid_on > MARKLIN_SOLENOID_LIMIT) marklin_stats.solenoid_overheats++;
+		marklin_solenoid = 0;
+	}
+	else if(c == MARKLIN_GO) marklin_go = 1;
+	else if(c == MARKLIN_STOP) marklin_go = 0;
+	else if(c == MARKLIN_RESET_OFF) marklin_reset_mode = 0;
+	else if(c == MARKLIN_RESET_ON) marklin_reset_mode = 1;
+	else if(c > MARKLIN_READ_MULTI && c <= MARKLIN_READ_MULTI + TRACK_DECODER_TOTAL) marklinSensorRead(0, c - MARKLIN_READ_MULTI, now);
+	else if(c > MARKLIN_READ_ONE && c <= MARKLIN_READ_ONE + TRACK_DECODER_TOTAL) marklinSensorRead(c - MARKLIN_READ_ONE - 1, 1, now);
+	else marklin_stats.invalid++;
+}
+
+static void marklinReply( HalTime now ) {
+	HalTime frame = halFrameTime(marklin_channel);
+	int i, j, sent = 0;
+	for(i = marklin_reply_first; i < marklin_reply_first + marklin_reply_count; i++) {
+		for(j = 0; j < 2; j++, sent++) {
+			halTransmit(marklin_channel, marklin_decoder_data[i * 2 + j]);
+			marklin_stats.reply_bytes++;
+
+			// Trip to arrival of the byte that carries it
+			int k;
+			for(k = 0; k < 8; k++) {
+				int sensor = i * TRACK_DECODER_SENSORS + j * 8 + k;
+				if(marklin_tripped[sensor] == 0) continue;
+				HalTime latency = now + (sent + 1) * frame - marklin_tripped[sensor];
+				marklin_stats.latency_count++;
+				marklin_stats.latency_total += latency;
+				if(latency > marklin_stats.latency_max) marklin_stats.latency_max = latency;
+				marklin_tripped[sensor] = 0;
+			}
+			if(marklin_reset_mode) marklin_decoder_data[i * 2 + j] = 0;
+		}
+	}
+	marklin_reply_count = 0;
+}
+
+/*
+ * Peer of COM1
+ */
+
+static void marklinReceive( void *context, char c ) {
+	HalTime now = halNow();
+	marklin_stats.bytes++;
+
+	// Busy with the byte, CTS drops until it is processed
+	marklin_busy = 1;
+	marklin_cts_until = now + marklin_config.cts_hold;
+	halSetCts(marklin_channel, 0);
+	marklinCommand((unsigned char)c, now);
+}
+
+static int marklinStalled( HalTime now ) {
+	return marklin_config.stall_for > 0 && now >= marklin_config.stall_at && now < marklin_config.stall_at + marklin_config.stall_for;
+}
+
+static void marklinPoll( void *context, HalTime now ) {
+	if(marklinStalled(now)) {
+		if(!marklin_busy) halSetCts(marklin_channel, 0);
+		marklin_busy = 1;
+	}
+	else if(marklin_busy && now >= marklin_cts_until && marklin_reply_count == 0) {
+		marklin_busy = 0;
+		halSetCts(marklin_channel, 1);
+	}
+	if(now - marklin_polled < MARKLIN_POLL_PERIOD) return;
+
+	double elapsed = (double)(now - marklin_polled) / HAL_NS_PER_SEC;
+	marklin_polled = now;
+
+	if(marklin_go) {
+		int i;
+		for(i = 0; i < marklin_train_total; i++) {
+			MarklinTrain *train = &marklin_trains[i];
+			marklinMove(train, marklin_speeds[train->number] * MARKLIN_MM_PER_SPEED * elapsed, now);
+		}
+	}
+
+	// Answer once the decoders are polled, CTS stays low until then
+	if(marklin_reply_count > 0 && now >= marklin_reply_time) marklinReply(now);
+}
+
+static HalPeer marklin_peer = { marklinReceive, marklinPoll, 0 };
+
+void marklinAttach( int channel, const MarklinConfig *config ) {
+	marklin_channel = channel;
+	marklin_config = *config;
+	halAttach(channel, &marklin_peer);
+}
+
+int marklinAddTrain( const char *spec ) {
+	if(marklin_train_total >= MARKLIN_TRAIN_MAX) return -1;
+	trackBootstrap();
+
+	char *end;
+	int number = strtol(spec, &end, 10);
+	if(number < 1 || number > MARKLIN_TRAIN_NUMBER_MAX || *end != '@') return -1;
+
+	MarklinTrain *train = &marklin_trains[marklin_train_total];
+	train->number = number;
+	train->waypoint_total = 0;
+	spec = end;
+	while(*spec == '@' || *spec == ',') {
+		spec++;
+		int sensor = TRACK_NONE;
+		char name[4] = { 0 };
+		int i;
+		for(i = 0; i < 3 && *spec != '\0' && *spec != ',' && *spec != ':'; i++) name[i] = *spec++;
+		sensor = trackSensorIndex(name);
+		if(sensor == TRACK_NONE || train->waypoint_total >= MARKLIN_WAYPOINT_MAX) return -1;
+		train->waypoints[train->waypoint_total++] = sensor;
+	}
+	if(*spec == ':') {
+		int speed = strtol(spec + 1, &end, 10);
+		if(speed < 0 || speed > MARKLIN_SPEED_MAX || *end != '\0') return -1;
+		marklin_speeds[number] = speed;
+	}
+	else if(*spec != '\0') return -1;
+
+	// Starts right on its first sensor
+	train->last = train->waypoints[0];
+	train->next = marklinFollow(train->last);
+	train->remaining = MARKLIN_SEGMENT_MM;
+	train->waypoint_next = 0;
+	if(train->waypoint_total > 1) {
+		train->waypoint_next = 1;
+		marklinThrowRoute(train->last, train->waypoints[1]);
+		train->next = marklinFollow(train->last);
+	}
+	marklin_train_total++;
+	return 0;
+}
+
+void marklinMetrics( HostMetrics *metrics ) {
+	metrics->sensor_reads = marklin_stats.reads;
+	metrics->invalid = marklin_stats.invalid;
+	metrics->trips = marklin_stats.latency_count;
+	metrics->sensor_latency_mean = marklin_stats.latency_count > 0 ? (double)marklin_stats.latency_total / marklin_stats.latency_count / (1000 * HAL_NS_PER_US) : 0.0;
+	metrics->sensor_latency_max = (double)marklin_stats.latency_max / (1000 * HAL_NS_PER_US);
+}
+
+void marklinStat() {
+	if(marklin_channel < 0) return;
+	HalTime now = halNow();
+	double seconds = (double)now / HAL_NS_PER_SEC;
+	int i;
+
+	fprintf(stderr, "Marklin: bytes %llu, commands %llu (%.1f/s), invalid %llu\n",
+		marklin_stats.bytes, marklin_stats.commands, seconds > 0 ? marklin_stats.commands / seconds : 0.0, marklin_stats.invalid);
+	fprintf(stderr, "Marklin: speeds %llu, reverses %llu, switches %llu, solenoid offs %llu, solenoid over %llums %llu\n",
+		marklin_stats.speeds, marklin_stats.reverses, marklin_stats.switches, marklin_stats.solenoid_offs,
+		MARKLIN_SOLENOID_LIMIT / (1000 * HAL_NS_PER_US), marklin_stats.solenoid_overheats);
+	fprintf(stderr, "Marklin: sensor reads %llu, reply bytes %llu, trips %llu, end of track %llu\n",
+		marklin_stats.reads, marklin_stats.reply_bytes, marklin_stats.trips, marklin_stats.ends);
+	if(marklin_stats.latency_count > 0) {
+		fprintf(stderr, "Marklin: sensor latency (trip to reply received) mean %lluus, max %lluus over %llu trips\n",
+			marklin_stats.latency_total / marklin_stats.latency_count / HAL_NS_PER_US,
+			marklin_stats.latency_max / HAL_NS_PER_US, marklin_stats.latency_count);
+	}
+	for(i = 0; i < marklin_train_total; i++) {
+		MarklinTrain *train = &marklin_trains[i];
+		fprintf(stderr, "Marklin: train %d at speed %d, %llu sensors passed\n", train->number, marklin_speeds[train->number], train->trips);
+	}
+}
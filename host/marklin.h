@@ -0,0 +1,43 @@
+/*
+ * marklin.h - simulated Märklin controller on COM1 for the host build
+ *
+ * Accepts the command bytes the panel sends, answers sensor reads with the
+ * decoder data of simulated trains moving on the track graph, and drives
+ * the CTS line the way the controller does.
+ */
+
+#ifndef __MARKLIN_H__
+#define __MARKLIN_H__
+
+#include "host.h"
+
+#define MARKLIN_TRAIN_MAX 8
+#define MARKLIN_WAYPOINT_MAX 8
+#define MARKLIN_CTS_HOLD (1000 * HAL_NS_PER_US)
+#define MARKLIN_REPLY_DELAY (5000 * HAL_NS_PER_US)
+
+typedef struct MarklinConfig {
+	HalTime cts_hold;	// CTS stays low for this long after each byte received
+	HalTime reply_delay;	// Time to poll the decoders before answering a sensor read
+	HalTime stall_at;	// CTS is held low from stall_at for stall_for, e.g. the set switched off
+	HalTime stall_for;	// 0 for no stall
+} MarklinConfig;
+
+void marklinAttach( int channel, const MarklinConfig *config );
+
+/*
+ * Place a train on the track, e.g. "58@A1" or "58@A1,C13,B16:10"
+ * 	58:	train number, its speed follows the commands of the panel
+ * 	A1:	sensor the train starts on, heading to the next node
+ * 	C13,B16:	scripted route, the controller throws the switches to the next
+ * 		waypoint each time the train passes one, and loops to the first
+ * 	10:	initial speed, so the train moves before any command
+ * Return: 0 Placed, -1 Invalid spec or too many trains
+ */
+int marklinAddTrain( const char *spec );
+
+void marklinStat();
+
+void marklinMetrics( HostMetrics *metrics );
+
+#endif // __MARKLIN_H__
@@ -0,0 +1,250 @@
+/*
+ * stress.c - many-train stress traffic on COM2 for the host build
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ts7200.h>
+#include <plio.h>
+#include <track.h>
+#include <control.h>
+#include "host.h"
+#include "stress.h"
+
+#define STRESS_LINE_MAX 16
+#define STRESS_PENDING_MAX 256	// Power of 2, above the depth of the train command queue
+#define STRESS_SENSOR_READ_FIRST 192	// Auto reset and single decoder reads
+#define STRESS_SENSOR_READ_LAST 197
+#define STRESS_TYPED_MAX 1024	// Power of 2, above the chars typed and not yet echoed
+#define STRESS_ESC 27
+#define STRESS_ECHO_LOOKAHEAD 8	// Typed chars skipped at most, lost by a COM2 overrun
+
+/*
+ * Wait of each byte in the train command queue, in ns
+ */
+typedef struct StressSamples {
+	HalTime *values;
+	unsigned int count;
+	unsigned int size;
+} StressSamples;
+
+static StressConfig stress_config;
+static HalTime stress_interval = 0;
+static HalTime stress_next_line = 0;
+static unsigned int stress_random = 1;
+
+/* Lines typed, by kind */
+static unsigned long long stress_lines[3];
+static unsigned long long stress_output = 0;
+
+/*
+ * The queue is first in first out, so the n-th byte pushed is the n-th byte
+ * sent on COM1. Push times are indexed by push number.
+ */
+static HalTime stress_pushed_at[STRESS_PENDING_MAX];
+static unsigned int stress_observed = 0;
+static unsigned int stress_sent = 0;
+
+static StressSamples stress_commands;
+static StressSamples stress_sensors;
+
+/*
+ * Chars typed are echoed, in order, by interactive messages: ESC [ s, a
+ * cursor move ended by H, then the chars typed since the last one, or
+ * ESC [ K right away for the EOL. Chars lost to an overrun, or typed and
+ * cleared before the echo, are never echoed, so echoes are matched by char.
+ */
+static HalTime stress_typed_at[STRESS_TYPED_MAX];
+static char stress_typed_chars[STRESS_TYPED_MAX];
+static unsigned int stress_typed = 0;
+static unsigned int stress_echoed = 0;
+static unsigned int stress_echo_state = 0;	// Chars of ESC [ s matched, then 3 in the move, 4 at the first char, 5 in the chars
+static StressSamples stress_echoes;
+
+static unsigned int stressRandom( unsigned int range ) {
+	stress_random = stress_random * 1103515245 + 12345;
+	return (stress_random >> 8) % range;
+}
+
+static void samplesAdd( StressSamples *samples, HalTime value ) {
+	if(samples->count == samples->size) {
+		samples->size = samples->size ? samples->size * 2 : 1024;
+		samples->values = realloc(samples->values, samples->size * sizeof(HalTime));
+	}
+	samples->values[samples->count++] = value;
+}
+
+static int samplesCompare( const void *a, const void *b ) {
+	HalTime x = *(const HalTime *)a, y = *(const HalTime *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void samplesSort( StressSamples *samples ) {
+	qsort(samples->values, samples->count, sizeof(HalTime), samplesCompare);
+}
+
+// Of sorted samples, in ms
+static double samplesAt( StressSamples *samples, unsigned long long percent ) {
+	if(samples->count == 0) return 0.0;
+	unsigned long long index = samples->count * percent / 100;
+	if(index >= samples->count) index = samples->count - 1;
+	return (double)samples->values[index] / (1000 * HAL_NS_PER_US);
+}
+
+static void samplesPrint( const char *name, const char *what, StressSamples *samples ) {
+	if(samples->count == 0) {
+		fprintf(stderr, "Stress: %s: none\n", name);
+		return;
+	}
+	samplesSort(samples);
+	fprintf(stderr, "Stress: %s: %u, %s p50 %.2fms, p99 %.2fms, max %.2fms\n", name, samples->count, what,
+		samplesAt(samples, 50), samplesAt(samples, 99), samplesAt(samples, 100));
+}
+
+/*
+ * Traffic
+ */
+
+static int stressSwitchId( unsigned int index ) {
+	return index < 18 ? index + 1 : index - 18 + 153;
+}
+
+static void stressTypeLine() {
+	char line[STRESS_LINE_MAX];
+	int total = stress_config.mix[0] + stress_config.mix[1] + stress_config.mix[2];
+	int pick = stressRandom(total), train = stressRandom(stress_config.trains) + 1;
+	int size, i;
+
+	if(pick < stress_config.mix[0]) {
+		size = snprintf(line, sizeof(line), "tr %d %d\r", train, stressRandom(15));
+		stress_lines[0]++;
+	}
+	else if(pick < stress_config.mix[0] + stress_config.mix[1]) {
+		size = snprintf(line, sizeof(line), "rv %d\r", train);
+		stress_lines[1]++;
+	}
+	else {
+		size = snprintf(line, sizeof(line), "sw %d %c\r", stressSwitchId(stressRandom(TRACK_SWITCH_TOTAL)), stressRandom(2) ? 'C' : 'S');
+		stress_lines[2]++;
+	}
+	HalTime now = halNow();
+	for(i = 0; i < size; i++) {
+		halTransmit(COM2, line[i]);
+		stress_typed_chars[stress_typed % STRESS_TYPED_MAX] = line[i];
+		stress_typed_at[stress_typed++ % STRESS_TYPED_MAX] = now;
+	}
+}
+
+/*
+ * Peer of COM2, and tap of COM1
+ */
+
+static void stressEcho( char c ) {
+	unsigned int i;
+	if(c == STRESS_ESC) c = '\r';
+	for(i = stress_echoed; i != stress_typed && i - stress_echoed < STRESS_ECHO_LOOKAHEAD; i++) {
+		if(stress_typed_chars[i % STRESS_TYPED_MAX] != c) continue;
+		samplesAdd(&stress_echoes, halNow() - stress_typed_at[i % STRESS_TYPED_MAX]);
+		stress_echoed = i + 1;
+		return;
+	}
+}
+
+static void stressReceive( void *context, char c ) {
+	static const char start[] = { STRESS_ESC, '[', 's' };
+	stress_output++;
+	
+	if(stress_echo_state < sizeof(start)) {
+		stress_echo_state = c == start[stress_echo_state] ? stress_echo_state + 1 : (c == STRESS_ESC);
+	}
+	else if(stress_echo_state == sizeof(start)) {
+		if(c == 'H') stress_echo_state++;
+	}
+	else if(c != STRESS_ESC || stress_echo_state == sizeof(start) + 1) {
+		stressEcho(c);
+		stress_echo_state = c == STRESS_ESC ? 1 : sizeof(start) + 2;
+	}
+	else {
+		stress_echo_state = 1;
+	}
+}
+
+static void stressPoll( void *context, HalTime now ) {
+	// Pushes since the last register access happened just now
+	while(stress_observed != train_commands_pushed) {
+		stress_pushed_at[stress_observed % STRESS_PENDING_MAX] = now;
+		stress_observed++;
+	}
+
+	if(now >= stress_next_line) {
+		stress_next_line += stress_interval;
+		if(stress_next_line < now) stress_next_line = now + stress_interval;
+		stressTypeLine();
+	}
+}
+
+static void stressTap( char c, HalTime start ) {
+	unsigned char command = c;
+	if(stress_sent == stress_observed) return; // Not pushed through the queue
+	HalTime wait = start - stress_pushed_at[stress_sent % STRESS_PENDING_MAX];
+	stress_sent++;
+
+	if(command >= STRESS_SENSOR_READ_FIRST && command <= STRESS_SENSOR_READ_LAST) samplesAdd(&stress_sensors, wait);
+	else samplesAdd(&stress_commands, wait);
+}
+
+static HalPeer stress_peer = { stressReceive, stressPoll, 0 };
+
+int stressParse( const char *spec, StressConfig *config ) {
+	char *end;
+	config->rate = strtol(spec, &end, 10);
+	config->trains = STRESS_TRAIN_MAX;
+	config->mix[0] = 70;
+	config->mix[1] = 10;
+	config->mix[2] = 20;
+	config->seed = 1;
+	if(config->rate <= 0) return -1;
+	if(*end == ':') {
+		config->trains = strtol(end + 1, &end, 10);
+		if(config->trains < 1 || config->trains > STRESS_TRAIN_MAX) return -1;
+	}
+	if(*end == ':') {
+		if(sscanf(end + 1, "%d,%d,%d", &config->mix[0], &config->mix[1], &config->mix[2]) != 3) return -1;
+		if(config->mix[0] < 0 || config->mix[1] < 0 || config->mix[2] < 0) return -1;
+		if(config->mix[0] + config->mix[1] + config->mix[2] == 0) return -1;
+		return 0;
+	}
+	return *end == '\0' ? 0 : -1;
+}
+
+void stressAttach( const StressConfig *config ) {
+	stress_config = *config;
+	stress_random = config->seed;
+	stress_interval = HAL_NS_PER_SEC / config->rate;
+	stress_next_line = HAL_NS_PER_SEC; // Once the panel has booted
+	halAttach(COM2, &stress_peer);
+	halTap(COM1, stressTap);
+}
+
+void stressMetrics( HostMetrics *metrics ) {
+	samplesSort(&stress_commands);
+	metrics->commands = stress_commands.count;
+	metrics->command_p50 = samplesAt(&stress_commands, 50);
+	metrics->command_p99 = samplesAt(&stress_commands, 99);
+	metrics->command_max = samplesAt(&stress_commands, 100);
+}
+
+void stressStat() {
+	if(stress_interval == 0) return;
+	HalTime now = halNow();
+	double seconds = (double)now / HAL_NS_PER_SEC;
+
+	fprintf(stderr, "Stress: %d lines/s over %d trains, typed tr %llu, rv %llu, sw %llu (%.1f lines/s), output %llu bytes\n",
+		stress_config.rate, stress_config.trains, stress_lines[0], stress_lines[1], stress_lines[2],
+		seconds > 1 ? (stress_lines[0] + stress_lines[1] + stress_lines[2]) / (seconds - 1) : 0.0, stress_output);
+	fprintf(stderr, "Stress: train commands pushed %u, dropped (queue full) %u in %u rejected groups, still queued %u\n",
+		train_commands_pushed, train_commands_dropped, train_commands_rejected, stress_observed - stress_sent);
+	samplesPrint("command bytes", "queue to COM1", &stress_commands);
+	samplesPrint("sensor requests", "queue to COM1", &stress_sensors);
+	samplesPrint("echoes", "typed to echo", &stress_echoes);
+}
@@ -0,0 +1,35 @@
+/*
+ * stress.h - many-train stress traffic on COM2 for the host build
+ *
+ * Types a random mix of tr, rv and sw lines into COM2 at a fixed rate, in
+ * place of the terminal, and measures how long each byte queued by
+ * pushTrainCommand waits before it leaves COM1.
+ */
+
+#ifndef __STRESS_H__
+#define __STRESS_H__
+
+#include "host.h"
+
+#define STRESS_TRAIN_MAX 80
+
+typedef struct StressConfig {
+	int rate;	// Lines per second
+	int trains;	// Train numbers 1 to trains
+	int mix[3];	// Weights of tr, rv and sw lines
+	unsigned int seed;	// Of the random lines, 1 unless given
+} StressConfig;
+
+/*
+ * Parse RATE[:TRAINS[:TR,RV,SW]], e.g. "50", "200:80" or "100:40:70,10,20"
+ * Return: 0 Parsed, -1 Invalid spec
+ */
+int stressParse( const char *spec, StressConfig *config );
+
+void stressAttach( const StressConfig *config );
+
+void stressStat();
+
+void stressMetrics( HostMetrics *metrics );
+
+#endif // __STRESS_H__
@@ -0,0 +1,347 @@
+/*
+ * sweep.c - run the host build over a grid of settings, many runs at once
+ *
+ * Each run is its own process of train_control_panel_host, with its own
+ * simulated controller and workload, so runs share nothing and take all the
+ * cores. A run prints one CSV record of its metrics on exit (-m), and the
+ * sweep prints it under the settings and the seed it was run with.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "host.h"
+
+#define SWEEP_HOST "./train_control_panel_host"
+#define SWEEP_KEY_MAX 16
+#define SWEEP_VALUE_MAX 64
+#define SWEEP_ARG_MAX 64
+#define SWEEP_JOB_MAX 256
+#define SWEEP_RECORD_MAX 512
+#define SWEEP_TIME_LIMIT "10"	// Seconds of simulated time, unless given
+#define SWEEP_CLOCK "100"	// Virtual clock, unless given: deterministic runs, as fast as the host goes
+
+/*
+ * A key of the grid and the values it takes. Keys of the core's timings go
+ * together into -k, a one-letter key is an option of the host.
+ */
+typedef struct SweepKey {
+	char name[16];
+	int tuning;
+	char *values[SWEEP_VALUE_MAX];
+	int total;
+} SweepKey;
+
+typedef struct SweepJob {
+	pid_t pid;
+	int fd;	// Stderr of the run, closed at its end
+	unsigned int run;
+	char record[SWEEP_RECORD_MAX];	// Last line of its stderr
+	unsigned int size;
+	int complete;	// The line has ended, the next char starts another
+} SweepJob;
+
+static SweepKey sweep_keys[SWEEP_KEY_MAX];
+static int sweep_key_total = 0;
+static char **sweep_common = 0;	// Options given to every run, after --
+static int sweep_common_total = 0;
+static const char *sweep_host = SWEEP_HOST;
+static unsigned int sweep_seeds = 1;
+
+static const char *sweep_tuning_keys[] = { "delay", "pause", "timeout", "window", 0 };
+
+static double sweepSeconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * KEY=V1,V2,...
+ * Return: 0 Added, -1 Invalid key or too many keys or values
+ */
+static int sweepParseKey( char *spec ) {
+	char *values = strchr(spec, '=');
+	int i;
+	if(values == 0 || sweep_key_total >= SWEEP_KEY_MAX || values - spec >= (int)sizeof(sweep_keys[0].name)) return -1;
+	SweepKey *key = &sweep_keys[sweep_key_total];
+	*values++ = '\0';
+	strcpy(key->name, spec);
+	key->tuning = 0;
+	for(i = 0; sweep_tuning_keys[i] != 0; i++) {
+		if(strcmp(key->name, sweep_tuning_keys[i]) == 0) key->tuning = 1;
+	}
+	if(!key->tuning && strlen(key->name) != 1) return -1;
+
+	key->total = 0;
+	char *value;
+	for(value = strtok(values, ","); value != 0; value = strtok(0, ",")) {
+		if(key->total >= SWEEP_VALUE_MAX) return -1;
+		key->values[key->total++] = value;
+	}
+	if(key->total == 0) return -1;
+	sweep_key_total++;
+	return 0;
+}
+
+static int sweepCommonHas( const char *option, const char *long_option ) {
+	int i;
+	for(i = 0; i < sweep_common_total; i++) {
+		if(strcmp(sweep_common[i], option) == 0 || strncmp(sweep_common[i], long_option, strlen(long_option)) == 0) return 1;
+	}
+	for(i = 0; i < sweep_key_total; i++) {
+		if(!sweep_keys[i].tuning && sweep_keys[i].name[0] == option[1]) return 1;
+	}
+	return 0;
+}
+
+// Value of each key for a run: the last key changes the fastest, the seed faster still
+static const char *sweepValue( unsigned int run, int key ) {
+	unsigned int index = run / sweep_seeds;
+	int i;
+	for(i = sweep_key_total - 1; i > key; i--) index /= sweep_keys[i].total;
+	return sweep_keys[key].values[index % sweep_keys[key].total];
+}
+
+static unsigned int sweepSeed( unsigned int run ) {
+	return run % sweep_seeds + 1;
+}
+
+// Command line of a run, into argv and the storage of its option values
+static void sweepArguments( unsigned int run, char *argv[], char storage[][SWEEP_RECORD_MAX] ) {
+	int argc = 0, stored = 0, i;
+	argv[argc++] = (char *)sweep_host;
+	argv[argc++] = "-m";
+	if(!sweepCommonHas("-v", "--virtual-clock")) {
+		argv[argc++] = "-v";
+		argv[argc++] = SWEEP_CLOCK;
+	}
+	if(!sweepCommonHas("-t", "--time-limit")) {
+		argv[argc++] = "-t";
+		argv[argc++] = SWEEP_TIME_LIMIT;
+	}
+
+	char *tuning = storage[stored++];
+	tuning[0] = '\0';
+	for(i = 0; i < sweep_key_total; i++) {
+		if(sweep_keys[i].tuning) {
+			if(tuning[0] != '\0') strcat(tuning, ",");
+			strcat(tuning, sweep_keys[i].name);
+			strcat(tuning, "=");
+			strcat(tuning, sweepValue(run, i));
+		}
+		else {
+			char *option = storage[stored++];
+			option[0] = '-';
+			option[1] = sweep_keys[i].name[0];
+			option[2] = '\0';
+			argv[argc++] = option;
+			argv[argc++] = (char *)sweepValue(run, i);
+		}
+	}
+	if(tuning[0] != '\0') {
+		argv[argc++] = "-k";
+		argv[argc++] = tuning;
+	}
+
+	char *seed = storage[stored++];
+	snprintf(seed, SWEEP_RECORD_MAX, "%u", sweepSeed(run));
+	argv[argc++] = "-s";
+	argv[argc++] = seed;
+
+	for(i = 0; i < sweep_common_total && argc < SWEEP_ARG_MAX - 1; i++) argv[argc++] = sweep_common[i];
+	argv[argc] = 0;
+}
+
+/*
+ * Start a run, its stdin and stdout on /dev/null, its stderr on a pipe
+ * Return: 0 Started, -1 Unable to
+ */
+static int sweepStart( SweepJob *job, unsigned int run ) {
+	char *argv[SWEEP_ARG_MAX];
+	char storage[SWEEP_KEY_MAX + 2][SWEEP_RECORD_MAX];
+	int pipes[2];
+	sweepArguments(run, argv, storage);
+	if(pipe(pipes) < 0) return -1;
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		close(pipes[0]);
+		close(pipes[1]);
+		return -1;
+	}
+	if(pid == 0) {
+		int null = open("/dev/null", O_RDWR);
+		dup2(null, STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		dup2(pipes[1], STDERR_FILENO);
+		close(pipes[0]);
+		execv(sweep_host, argv);
+		fprintf(stderr, "Unable to run %s\n", sweep_host);
+		_exit(127);
+	}
+	close(pipes[1]);
+	job->pid = pid;
+	job->fd = pipes[0];
+	job->run = run;
+	job->size = 0;
+	job->complete = 0;
+	return 0;
+}
+
+// The last line of the run's stderr is its record, anything before it went wrong
+static void sweepRead( SweepJob *job ) {
+	char buffer[SWEEP_RECORD_MAX];
+	int size = read(job->fd, buffer, sizeof(buffer));
+	int i;
+	if(size <= 0) {
+		close(job->fd);
+		job->fd = -1;
+		job->record[job->size] = '\0';
+		return;
+	}
+	for(i = 0; i < size; i++) {
+		if(job->complete) {
+			job->size = 0;
+			job->complete = 0;
+		}
+		if(buffer[i] == '\n') job->complete = 1;
+		else if(job->size < SWEEP_RECORD_MAX - 1) job->record[job->size++] = buffer[i];
+	}
+}
+
+static void sweepUsage( const char *name ) {
+	fprintf(stderr,
+		"Usage: %s [options] [-- host options]\n"
+		"  -g, --grid KEY=V1,V2,...  values to sweep: delay, pause, timeout or window of the core (see -k of the host),\n"
+		"                            or a one-letter option of the host, e.g. d=3000,5000 or S=50:20,100:20\n"
+		"  -n, --seeds N             runs of each setting, with the stress seeds 1 to N (default 1)\n"
+		"  -j, --jobs N              runs at once (default: one per online CPU)\n"
+		"  -b, --host PATH           host build to run (default " SWEEP_HOST ")\n"
+		"Runs get -v " SWEEP_CLOCK " and -t " SWEEP_TIME_LIMIT " unless given. Prints a CSV line per run:\n"
+		"  the keys, seed, " HOST_METRICS_HEADER "\n",
+		name);
+}
+
+int main( int argc, char *argv[] ) {
+	static const struct option options[] = {
+		{ "grid", required_argument, 0, 'g' },
+		{ "seeds", required_argument, 0, 'n' },
+		{ "jobs", required_argument, 0, 'j' },
+		{ "host", required_argument, 0, 'b' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	static SweepJob jobs[SWEEP_JOB_MAX];
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	int job_total = online > 0 ? online : 1;
+	int option, i;
+
+	while((option = getopt_long(argc, argv, "g:n:j:b:h", options, 0)) != -1) {
+		switch(option) {
+			case 'g':
+				if(sweepParseKey(optarg) < 0) {
+					fprintf(stderr, "Invalid grid %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'n':
+				sweep_seeds = strtoul(optarg, 0, 10);
+				if(sweep_seeds == 0) sweep_seeds = 1;
+				break;
+			case 'j':
+				job_total = atoi(optarg);
+				break;
+			case 'b':
+				sweep_host = optarg;
+				break;
+			default:
+				sweepUsage(argv[0]);
+				return option == 'h' ? 0 : 1;
+		}
+	}
+	if(job_total < 1) job_total = 1;
+	if(job_total > SWEEP_JOB_MAX) job_total = SWEEP_JOB_MAX;
+	sweep_common = argv + optind;
+	sweep_common_total = argc - optind;
+
+	unsigned int run_total = sweep_seeds;
+	for(i = 0; i < sweep_key_total; i++) run_total *= sweep_keys[i].total;
+
+	// Records come back in any order, they are printed in the order of the runs
+	char **records = calloc(run_total, sizeof(char *));
+	unsigned int started = 0, printed = 0, failed = 0;
+	double seconds = 0, wall = sweepSeconds();
+
+	for(i = 0; i < sweep_key_total; i++) printf("%s,", sweep_keys[i].name);
+	printf("seed,%s\n", HOST_METRICS_HEADER);
+
+	for(i = 0; i < job_total; i++) jobs[i].pid = 0;
+	while(printed < run_total) {
+		// Keep every job busy
+		for(i = 0; i < job_total && started < run_total; i++) {
+			if(jobs[i].pid != 0) continue;
+			if(sweepStart(&jobs[i], started) < 0) {
+				fprintf(stderr, "Unable to start run %u\n", started);
+				return 1;
+			}
+			started++;
+		}
+
+		// Wait on the output of any of them
+		struct pollfd fds[SWEEP_JOB_MAX];
+		int index[SWEEP_JOB_MAX], total = 0;
+		for(i = 0; i < job_total; i++) {
+			if(jobs[i].pid == 0 || jobs[i].fd < 0) continue;
+			fds[total].fd = jobs[i].fd;
+			fds[total].events = POLLIN;
+			index[total++] = i;
+		}
+		if(total > 0 && poll(fds, total, -1) > 0) {
+			for(i = 0; i < total; i++) {
+				if(fds[i].revents) sweepRead(&jobs[index[i]]);
+			}
+		}
+
+		// Collect the runs done
+		for(i = 0; i < job_total; i++) {
+			SweepJob *job = &jobs[i];
+			int status;
+			if(job->pid == 0 || job->fd >= 0) continue;
+			waitpid(job->pid, &status, 0);
+			job->pid = 0;
+			if(!WIFEXITED(status) || WEXITSTATUS(status) != 0 || strchr(job->record, ',') == 0) {
+				fprintf(stderr, "Run %u failed: %s\n", job->run, job->record);
+				records[job->run] = strdup("");
+				failed++;
+			}
+			else {
+				records[job->run] = strdup(job->record);
+				seconds += atof(job->record);
+			}
+		}
+
+		// Print the runs done in order
+		while(printed < run_total && records[printed] != 0) {
+			if(records[printed][0] != '\0') {
+				for(i = 0; i < sweep_key_total; i++) printf("%s,", sweepValue(printed, i));
+				printf("%u,%s\n", sweepSeed(printed), records[printed]);
+			}
+			free(records[printed]);
+			printed++;
+		}
+		fflush(stdout);
+	}
+
+	wall = sweepSeconds() - wall;
+	fprintf(stderr, "Sweep: %u runs, %u failed, %.2f simulated hours in %.1fs over %d jobs (%.0fx real time)\n",
+		run_total, failed, seconds / 3600, wall, job_total, wall > 0 ? seconds / wall : 0.0);
+	free(records);
+	return failed > 0;
+}
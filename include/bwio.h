@@ -8,6 +8,12 @@
 #ifndef __VA_LIST_H__
 #define __VA_LIST_H__
 
+#ifdef HOST
+
+#include <stdarg.h>
+
+#else
+
 typedef char *va_list;
 
 #define __va_argsiz(t)	\
@@ -20,6 +26,8 @@ typedef char *va_list;
 #define va_arg(ap, t)	\
 		 (((ap) = (ap) + __va_argsiz(t)), *((t*) (void*) ((ap) - __va_argsiz(t))))
 
+#endif // HOST
+
 #define COM1	0
 #define COM2	1
 
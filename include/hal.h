@@ -0,0 +1,33 @@
+/*
+ * hal.h - access to the TS-7200 peripheral registers
+ *
+ * On the board a register is its memory mapped address. In the host build
+ * (HOST defined) every access goes to the simulated peripherals in host/.
+ */
+
+#ifndef __HAL_H__
+#define __HAL_H__
+
+#ifdef HOST
+
+typedef unsigned int HalReg;
+
+int halRead( HalReg reg );
+
+void halWrite( HalReg reg, int value );
+
+#define HAL_REG(base, offset)	((HalReg)((base) + (offset)))
+#define HAL_READ(reg)	halRead(reg)
+#define HAL_WRITE(reg, value)	halWrite((reg), (value))
+
+#else
+
+typedef volatile int *HalReg;
+
+#define HAL_REG(base, offset)	((HalReg)((base) + (offset)))
+#define HAL_READ(reg)	(*(reg))
+#define HAL_WRITE(reg, value)	(*(reg) = (value))
+
+#endif // HOST
+
+#endif // __HAL_H__
@@ -5,9 +5,18 @@
 #ifndef __PLIO_H__
 #define __PLIO_H__
 
+#include <ts7200.h>
+#include <hal.h>
+
 #ifndef __VA_LIST_H__
 #define __VA_LIST_H__
 
+#ifdef HOST
+
+#include <stdarg.h>
+
+#else
+
 typedef char *va_list;
 
 #define __va_argsiz(t)	\
@@ -20,6 +29,8 @@ typedef char *va_list;
 #define va_arg(ap, t)	\
 		 (((ap) = (ap) + __va_argsiz(t)), *((t*) (void*) ((ap) - __va_argsiz(t))))
 
+#endif // HOST
+
 #define COM1	0
 #define COM2	1
 
@@ -28,37 +39,183 @@ typedef char *va_list;
 
 #endif // __VA_LIST_H__
 
-#define CHANNEL_COUNT	2
+#define CHANNEL_COUNT	2	// Channels opened by plbootstrap, COM1 and COM2
+#define CHANNEL_MAX	4
 #define OUTPUT_BUFFER_SIZE 20000
 
+#define PLOPEN_CTS	0x1	// Only send while the UART asserts CTS
+
+#define PLSTALL_TICKS	1000	// Wait on CTS counted as a stall, in Timer3 ticks (1/2000 sec)
+
+/*
+ * Output lanes of a channel. The interactive lane is sent first, but never
+ * inside a unit of the bulk lane, nor the other way round. Units are told
+ * apart by the channel's framer: escape sequences by default.
+ */
+#define PLLANE_BULK	0	// Everything else, the default
+#define PLLANE_INTERACTIVE	1	// Short and urgent, e.g. keystroke echo or an emergency stop
+#define PLLANE_TOTAL	2
+#define PLLANE_INTERACTIVE_SIZE	256
+
+/*
+ * Framer of a channel's output
+ * Return: state once c is sent, 0 at a boundary between units
+ */
+typedef unsigned int (*PlFramer)( unsigned int state, char c );
+
+typedef struct PlLane {
+	char *ring;
+	unsigned int size;
+	unsigned int send_index;
+	unsigned int save_index;
+	unsigned int frame;	// Framer state of the bytes sent, 0 at a boundary
+} PlLane;
+
+/*
+ * A UART and its output lanes. The registers and the flags to test before
+ * sending are worked out once by plopen, so the hot paths taking a
+ * PlChannel do no per-byte dispatch on the channel number.
+ *
+ * The flag register is read at most once between two plchinvalidate calls,
+ * and the send and receive decisions share that snapshot. Sending a byte
+ * marks the transmitter full in it, receiving one drops it.
+ *
+ * A byte saved while both lanes are empty, with no unit of the other lane
+ * under way and the UART ready on the snapshot, is written through instead
+ * of waiting in its lane for the next plchsend.
+ */
+typedef struct PlChannel {
+	HalReg flags;
+	HalReg data;
+	unsigned int tx_mask;	// Flags tested before sending a byte
+	unsigned int tx_ready;	// Their value when the UART can take one
+	unsigned int status;	// Snapshot of the flag register, if status_valid
+	unsigned int status_valid;
+	unsigned int status_reads;	// Flag register reads, and decisions made on the snapshot instead
+	unsigned int status_hits;
+	PlLane lanes[PLLANE_TOTAL];
+	PlLane *lane;	// Lane written to, see plsetlane
+	PlFramer framer;
+	unsigned int total_send;
+	unsigned int total_save;
+	unsigned int total_direct;	// Of total_send, written through by plchsave
+	unsigned int stall_start;	// Timer3 value when the wait on CTS began
+	unsigned int stalling;	// Waiting on CTS with a byte to send
+	unsigned int stalls;	// Waits longer than PLSTALL_TICKS
+	unsigned int stall_max;	// Longest wait, in Timer3 ticks
+	int base;
+	int id;
+	char interactive[PLLANE_INTERACTIVE_SIZE];
+} PlChannel;
+
+/*
+ * Traffic record: one byte in or out of a channel
+ * time: Timer3 ticks (1/2000 sec) since the previous record
+ */
+#define PLREC_IN	0x80	// Received, otherwise sent
+#define PLREC_IDLE	0x40	// No byte, time only
+#define PLREC_CHANNEL_MASK	0x0f
+#define PLREC_TIME_MAX	0xffff
+
+typedef struct PlRecord {
+	unsigned short time;
+	unsigned char flags;
+	char data;
+} PlRecord;
+
 void plstat();
 
-void plbootstrap();
+/*
+ * Open COM1 (with CTS) and COM2, each with OUTPUT_BUFFER_SIZE bytes of
+ * buf_array as its output ring
+ */
+void plbootstrap( char *buf_array );
+
+/*
+ * Open a channel on the UART at base, with ring as its bulk lane
+ * options: PLOPEN_* flags
+ * Return: -1 Invalid channel or ring, 0 Opened
+ */
+int plopen( int channel, int base, int options, char *ring, unsigned int size );
+
+/*
+ * Return: the descriptor of an open channel, 0 if not open
+ */
+PlChannel *plchannel( int channel );
 
 void plflush( int channel );
 
 /* 
  * Try to send out a char
- * Return: -1 Unknown Channel, 0 Nothing to send, 1 Sent, 2 UART FIFO Full
+ * Return: -1 Unknown Channel, 0 Nothing to send, 1 Sent, 2 UART not ready (FIFO full, or no CTS)
  */
 int plsend( int channel );
 
+int plchsend( PlChannel *ch );
+
 int plsetfifo( int channel, int state );
 
+/*
+ * Lane written by the following output calls on the channel, PLLANE_*.
+ * Write a whole escape sequence, or a message of them, before switching back.
+ * Return: -1 Unknown Channel or lane, 0 Set
+ */
+int plsetlane( int channel, int lane );
+
+/*
+ * Replace the framer of the channel's lanes, 0 for escape sequences. The
+ * lanes restart at a boundary, whatever the old framer was in.
+ * Return: -1 Unknown Channel, 0 Set
+ */
+int plsetframer( int channel, PlFramer framer );
+
+/*
+ * Return: bytes waiting in a lane of the channel
+ */
+unsigned int plchpending( PlChannel *ch, int lane );
+
+/*
+ * Return: the channel's flag register, from its snapshot if there is one
+ */
+unsigned int plchstatus( PlChannel *ch );
+
+/*
+ * Drop the channel's snapshot of its flag register, the next send or receive
+ * reads it again. Called once per pass of the polling loop, and by plflush.
+ */
+void plchinvalidate( PlChannel *ch );
+
+/*
+ * Return: Timer3 ticks the channel has been waiting on CTS to send, 0 if not
+ */
+unsigned int plchstalled( PlChannel *ch );
+
 int plsetspeed( int channel, int speed );
 
 /* 
- * Put a char into the buffer
- * Return: -1 Unknown Channel, 0 No more space in the buffer, 1 Saved
+ * Put a char into the buffer, or straight into the UART if nothing waits
+ * and it is ready
+ * Return: -1 Unknown Channel, 0 No more space in the buffer, 1 Saved or sent
  */
 int plputc( int channel, char c );
 
+int plchsave( PlChannel *ch, char c );
+
+/* 
+ * Put a block into the buffer of the current lane whole, e.g. a prebuilt
+ * screen, without writing any of it through
+ * Return: -1 Unknown Channel, 0 Not enough space, nothing saved, 1 Saved
+ */
+int plputblock( int channel, const char *block, unsigned int size );
+
 /* 
  * Get a char from the buffer
  * Return: -1 Unknown Channel, 0 Nothing Read, 1 got a char and saved into *c
  */
 int plgetc( int channel, char *c );
 
+int plchgetc( PlChannel *ch, char *c );
+
 int plputx( int channel, char c );
 
 int plputstr( int channel, char *str );
@@ -73,4 +230,30 @@ void plui2a( unsigned int num, unsigned int base, char *bf );
 
 void pli2a( int num, char *bf );
 
+/*
+ * Record every byte sent and received on all channels into a ring,
+ * overwriting the oldest records once full. A null ring stops recording.
+ */
+void plrecord( PlRecord *ring, unsigned int size );
+
+/*
+ * Range of the ring holding the recording, oldest first
+ */
+void plrecorded( unsigned int *first, unsigned int *count );
+
+/*
+ * Feed the received bytes of a recording to plgetc with their original timing.
+ * Real input is ignored and recording is paused until the replay is done.
+ * Return: -1 Nothing to replay, 0 Started
+ */
+int plreplay( const PlRecord *ring, unsigned int size, unsigned int first, unsigned int count );
+
+int plreplaying();
+
+/*
+ * Busy-wait dump of the recording as hex, 4 bytes per record:
+ * time (high, low), flags, data
+ */
+void pldump( int channel );
+
 #endif // __PLIO_H__
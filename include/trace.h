@@ -0,0 +1,85 @@
+/*
+ * trace.h - binary trace ring, compiled away unless built with TRACE_ENABLE
+ *
+ * TRACE(event, a, b) saves the Timer3 time, the event and two int arguments
+ * into a RAM ring, without any formatting. When disabled, the arguments are
+ * not even evaluated.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <ts7200.h>
+#include <hal.h>
+
+/* Events, and their arguments */
+#define TRACE_TRAIN_PUSH 1	// command, delay
+#define TRACE_TRAIN_FULL 2	// commands of the group rejected, room left
+#define TRACE_TRAIN_SEND 3	// command, pause
+#define TRACE_TRAIN_RESUME 4	// pause left when overridden
+#define TRACE_SENSOR_FLUSH 5	// byte
+#define TRACE_SENSOR_REQUEST 6	// command
+#define TRACE_SENSOR_BYTE 7	// decoder byte index, data
+#define TRACE_SENSOR_HIT 8	// decoder, sensor number
+#define TRACE_SENSOR_TIMEOUT 9	// ticks waited
+#define TRACE_USER_COMMAND 10	// opcode, operand count
+#define TRACE_USER_INVALID 11	// debug timer ticks to parse
+#define TRACE_UART_CONFIG 12	// register offset, value
+#define TRACE_TIMER_CONTROL 13	// timer base, control value
+#define TRACE_TRAIN_REVERSE 14	// train, stopping ticks waited
+#define TRACE_COM1_URGENT 15	// command
+#define TRACE_COM1_STALL 16	// Timer3 ticks waited on CTS (0 once over), stalls so far
+#define TRACE_USER_FRAME 17	// sequence, TELEMETRY_STATUS_*
+#define TRACE_RULE_FIRE 18	// opcode of the action, commands queued
+#define TRACE_RULE_SENT 19	// first command of the action, us since the sensor byte arrived
+#define TRACE_EVENT_TOTAL 20
+
+#define TRACE_RING_SIZE 256	// Power of 2
+
+typedef struct TraceRecord {
+	unsigned int time;	// Timer3 ticks since it was enabled
+	int event;
+	int a;
+	int b;
+} TraceRecord;
+
+#ifdef TRACE_ENABLE
+
+#define TRACE_ENABLED 1
+
+extern TraceRecord trace_ring[TRACE_RING_SIZE];
+extern unsigned int trace_next;
+
+#define TRACE(e, x, y) do { \
+		TraceRecord *trace_record = &trace_ring[trace_next++ & (TRACE_RING_SIZE - 1)]; \
+		trace_record->time = ~HAL_READ(HAL_REG(TIMER3_BASE, VAL_OFFSET)); \
+		trace_record->event = (e); \
+		trace_record->a = (x); \
+		trace_record->b = (y); \
+	} while(0)
+
+#else
+
+#define TRACE_ENABLED 0
+
+#define TRACE(e, x, y) do { } while(0)
+
+#endif // TRACE_ENABLE
+
+/*
+ * Record saved back + 1 records ago
+ * Return: the record, 0 if none (or tracing is disabled)
+ */
+const TraceRecord *traceRecent(unsigned int back);
+
+/*
+ * Format string of an event, taking its two arguments
+ */
+const char *traceFormat(int event);
+
+/*
+ * Busy-wait dump of the whole ring, oldest first, formatted
+ */
+void traceDump(int channel);
+
+#endif // __TRACE_H__
@@ -5,6 +5,8 @@
  *
  */
 
+#define	CACHE_LINE_SIZE	32	// ARM920T data cache line, in bytes
+
 #define	TIMER1_BASE	0x80810000
 #define	TIMER2_BASE	0x80810020
 #define	TIMER3_BASE	0x80810080
@@ -17,6 +19,10 @@
 	#define	CLKSEL_MASK	0x00000008
 #define CLR_OFFSET	0x0000000c	// no data, WO
 
+#define	TIMER4_VALUE_LO	0x80810060	// 32 bits, RO, 983.04 kHz
+#define	TIMER4_VALUE_HI	0x80810064	// 8 bits, RO
+	#define	TIMER4_ENABLE_MASK	0x00000100
+
 
 #define LED_ADDRESS	0x80840020
 	#define LED_NONE	0x0
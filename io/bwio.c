@@ -6,6 +6,7 @@
  */
 
 #include <ts7200.h>
+#include <hal.h>
 #include <bwio.h>
 
 /*
@@ -16,34 +17,35 @@
  * 	fifos enabled
  */
 int bwsetfifo( int channel, int state ) {
-	int *line, buf;
+	HalReg line;
+	int buf;
 	switch( channel ) {
 	case COM1:
-		line = (int *)( UART1_BASE + UART_LCRH_OFFSET );
+		line = HAL_REG( UART1_BASE, UART_LCRH_OFFSET );
 	        break;
 	case COM2:
-	        line = (int *)( UART2_BASE + UART_LCRH_OFFSET );
+	        line = HAL_REG( UART2_BASE, UART_LCRH_OFFSET );
 	        break;
 	default:
 	        return -1;
 	        break;
 	}
-	buf = *line;
+	buf = HAL_READ( line );
 	buf = state ? buf | FEN_MASK : buf & ~FEN_MASK;
-	*line = buf;
+	HAL_WRITE( line, buf );
 	return 0;
 }
 
 int bwsetspeed( int channel, int speed ) {
-	int *high, *low;
+	HalReg high, low;
 	switch( channel ) {
 	case COM1:
-		high = (int *)( UART1_BASE + UART_LCRM_OFFSET );
-		low = (int *)( UART1_BASE + UART_LCRL_OFFSET );
+		high = HAL_REG( UART1_BASE, UART_LCRM_OFFSET );
+		low = HAL_REG( UART1_BASE, UART_LCRL_OFFSET );
 	        break;
 	case COM2:
-		high = (int *)( UART2_BASE + UART_LCRM_OFFSET );
-		low = (int *)( UART2_BASE + UART_LCRL_OFFSET );
+		high = HAL_REG( UART2_BASE, UART_LCRM_OFFSET );
+		low = HAL_REG( UART2_BASE, UART_LCRL_OFFSET );
 	        break;
 	default:
 	        return -1;
@@ -51,12 +53,12 @@ int bwsetspeed( int channel, int speed ) {
 	}
 	switch( speed ) {
 	case 115200:
-		*high = 0x0;
-		*low = 0x3;
+		HAL_WRITE( high, 0x0 );
+		HAL_WRITE( low, 0x3 );
 		return 0;
 	case 2400:
-		*high = 0x0;
-		*low = 0xbf;
+		HAL_WRITE( high, 0x0 );
+		HAL_WRITE( low, 0xbf );
 		return 0;
 	default:
 		return -1;
@@ -64,22 +66,22 @@ int bwsetspeed( int channel, int speed ) {
 }
 
 int bwputc( int channel, char c ) {
-	int *flags, *data;
+	HalReg flags, data;
 	switch( channel ) {
 	case COM1:
-		flags = (int *)( UART1_BASE + UART_FLAG_OFFSET );
-		data = (int *)( UART1_BASE + UART_DATA_OFFSET );
+		flags = HAL_REG( UART1_BASE, UART_FLAG_OFFSET );
+		data = HAL_REG( UART1_BASE, UART_DATA_OFFSET );
 		break;
 	case COM2:
-		flags = (int *)( UART2_BASE + UART_FLAG_OFFSET );
-		data = (int *)( UART2_BASE + UART_DATA_OFFSET );
+		flags = HAL_REG( UART2_BASE, UART_FLAG_OFFSET );
+		data = HAL_REG( UART2_BASE, UART_DATA_OFFSET );
 		break;
 	default:
 		return -1;
 		break;
 	}
-	while( ( *flags & TXFF_MASK ) ) ;
-	*data = c;
+	while( ( HAL_READ( flags ) & TXFF_MASK ) ) ;
+	HAL_WRITE( data, c );
 	return 0;
 }
 
@@ -123,24 +125,24 @@ void bwputw( int channel, int n, char fc, char *bf ) {
 }
 
 int bwgetc( int channel ) {
-	int *flags, *data;
+	HalReg flags, data;
 	unsigned char c;
 
 	switch( channel ) {
 	case COM1:
-		flags = (int *)( UART1_BASE + UART_FLAG_OFFSET );
-		data = (int *)( UART1_BASE + UART_DATA_OFFSET );
+		flags = HAL_REG( UART1_BASE, UART_FLAG_OFFSET );
+		data = HAL_REG( UART1_BASE, UART_DATA_OFFSET );
 		break;
 	case COM2:
-		flags = (int *)( UART2_BASE + UART_FLAG_OFFSET );
-		data = (int *)( UART2_BASE + UART_DATA_OFFSET );
+		flags = HAL_REG( UART2_BASE, UART_FLAG_OFFSET );
+		data = HAL_REG( UART2_BASE, UART_DATA_OFFSET );
 		break;
 	default:
 		return -1;
 		break;
 	}
-	while ( !( *flags & RXFF_MASK ) ) ;
-	c = *data;
+	while ( !( HAL_READ( flags ) & RXFF_MASK ) ) ;
+	c = HAL_READ( data );
 	return c;
 }
 
@@ -222,7 +224,7 @@ void bwformat ( int channel, char *fmt, va_list va ) {
 			switch( ch ) {
 			case 0: return;
 			case 'c':
-				bwputc( channel, va_arg( va, char ) );
+				bwputc( channel, (char) va_arg( va, int ) );
 				break;
 			case 's':
 				bwputw( channel, w, 0, va_arg( va, char* ) );
@@ -6,124 +6,343 @@
  */
 
 #include <ts7200.h>
+#include <hal.h>
 #include <plio.h>
 #include <bwio.h>
 
-static char *buffer;
-static unsigned int *buffer_send_index;
-static unsigned int *buffer_save_index;
+#define PL_ESC	27
 
-// static unsigned int max_send_index = 0;
-// static unsigned int max_save_index = 0;
-static unsigned int total_send[CHANNEL_COUNT];
-static unsigned int total_save[CHANNEL_COUNT];
+static PlChannel channels[CHANNEL_MAX];
+
+// Traffic recorder
+static PlRecord *record_ring = 0;
+static unsigned int record_size = 0;
+static unsigned int record_next = 0;
+static unsigned int record_total = 0;
+static unsigned int record_timer = 0;
+
+// Traffic replay
+static const PlRecord *replay_ring = 0;
+static unsigned int replay_size = 0;
+static unsigned int replay_first = 0;
+static unsigned int replay_count = 0;
+static unsigned int replay_timer = 0;
+static unsigned int replay_cursor[CHANNEL_MAX];	// Next record to look at
+static unsigned int replay_time[CHANNEL_MAX];	// Time of the records before the cursor
 
 void plstat() {
 	int i = 0;
-	for(i = 0; i < CHANNEL_COUNT; i++) {
-		bwprintf( COM2, "Channel #%d Send total: 0x%x\n", i, total_send[i]);
-		bwprintf( COM2, "Channel #%d Save total: 0x%x\n", i, total_save[i]);
+	for(i = 0; i < CHANNEL_MAX; i++) {
+		if(channels[i].lane == 0) continue;
+		bwprintf( COM2, "Channel #%d Send total: 0x%x\n", i, channels[i].total_send);
+		bwprintf( COM2, "Channel #%d Save total: 0x%x\n", i, channels[i].total_save);
+		bwprintf( COM2, "Channel #%d Written through: 0x%x\n", i, channels[i].total_direct);
+		bwprintf( COM2, "Channel #%d Flag reads: %u, snapshot hits: %u\n", i, channels[i].status_reads, channels[i].status_hits);
 	}
+	for(i = 0; i < CHANNEL_MAX; i++) {
+		if(channels[i].lane == 0 || channels[i].stall_max == 0) continue;
+		bwprintf( COM2, "Channel #%d Stalls: %d, longest %d ticks\n", i, channels[i].stalls, channels[i].stall_max);
+	}
+	bwprintf( COM2, "Record total: 0x%x\n", record_total);
 	return;
 }
 
-void plbootstrap(char *buf_array, unsigned int *buf_send_array, unsigned int *buf_save_array) {
-	buffer = buf_array;
-	buffer_send_index = buf_send_array;
-	buffer_save_index = buf_save_array;
+void plbootstrap( char *buf_array ) {
+	int i;
+	for(i = 0; i < CHANNEL_MAX; i++) channels[i].lane = 0;
+	plopen( COM1, UART1_BASE, PLOPEN_CTS, buf_array, OUTPUT_BUFFER_SIZE );
+	plopen( COM2, UART2_BASE, 0, buf_array + OUTPUT_BUFFER_SIZE, OUTPUT_BUFFER_SIZE );
+}
+
+// Default framer: escape sequences, 1 after ESC, 2 after ESC [ until the final byte
+static unsigned int plescape( unsigned int escape, char c ) {
+	if(c == PL_ESC) return 1;
+	if(escape == 1) return c == '[' ? 2 : 0;
+	if(escape == 2 && c >= 0x40 && c <= 0x7e) return 0;
+	return escape;
+}
+
+int plopen( int channel, int base, int options, char *ring, unsigned int size ) {
+	if(channel < 0 || channel >= CHANNEL_MAX || ring == 0 || size < 2) return -1;
+	PlChannel *ch = &channels[channel];
 	
-	// max_send_index = 0;
-	// max_save_index = 0;
-	// plstat();
+	ch->flags = HAL_REG( base, UART_FLAG_OFFSET );
+	ch->data = HAL_REG( base, UART_DATA_OFFSET );
+	ch->tx_mask = TXFF_MASK;
+	ch->tx_ready = 0;
+	ch->status_valid = 0;
+	ch->status_reads = 0;
+	ch->status_hits = 0;
+	if(options & PLOPEN_CTS) {
+		ch->tx_mask |= CTS_MASK;
+		ch->tx_ready |= CTS_MASK;
+	}
+	ch->base = base;
+	ch->id = channel;
 	
-	int i, j;
-	for(i = 0; i < CHANNEL_COUNT; i++) {
-		for(j = 0; j < OUTPUT_BUFFER_SIZE; j++) {
-			buffer[(i * OUTPUT_BUFFER_SIZE) + j] = '\0';
-		}
-		buffer_send_index[i] = 0;
-		buffer_save_index[i] = 0;
-		
-		total_send[i] = 0;
-		total_save[i] = 0;
+	// Only the bytes between the indices of a lane are read, the rings are not cleared
+	unsigned int i;
+	ch->lanes[PLLANE_BULK].ring = ring;
+	ch->lanes[PLLANE_BULK].size = size;
+	ch->lanes[PLLANE_INTERACTIVE].ring = ch->interactive;
+	ch->lanes[PLLANE_INTERACTIVE].size = PLLANE_INTERACTIVE_SIZE;
+	for(i = 0; i < PLLANE_TOTAL; i++) {
+		ch->lanes[i].send_index = 0;
+		ch->lanes[i].save_index = 0;
+		ch->lanes[i].frame = 0;
 	}
+	ch->lane = &ch->lanes[PLLANE_BULK];
+	ch->framer = plescape;
+	ch->total_send = 0;
+	ch->total_direct = 0;
+	ch->stalling = 0;
+	ch->stalls = 0;
+	ch->stall_max = 0;
+	ch->total_save = 0;
+	return 0;
+}
+
+PlChannel *plchannel( int channel ) {
+	if(channel < 0 || channel >= CHANNEL_MAX || channels[channel].lane == 0) return 0;
+	return &channels[channel];
+}
+
+unsigned int plchstatus( PlChannel *ch ) {
+	if(ch->status_valid) {
+		ch->status_hits++;
+		return ch->status;
+	}
+	ch->status = HAL_READ( ch->flags );
+	ch->status_valid = 1;
+	ch->status_reads++;
+	return ch->status;
+}
+
+void plchinvalidate( PlChannel *ch ) {
+	ch->status_valid = 0;
+}
+
+static unsigned int pltimer() {
+	return HAL_READ( HAL_REG( TIMER3_BASE, VAL_OFFSET ) );
+}
+
+static void plrecordsave( int flags, unsigned int time, char c ) {
+	PlRecord *record = &record_ring[record_next];
+	record->time = time;
+	record->flags = flags;
+	record->data = c;
+	record_next = (record_next + 1) % record_size;
+	record_total++;
+}
+
+static void plrecordbyte( int flags, char c ) {
+	// Timer3 counts down
+	unsigned int now = pltimer();
+	unsigned int elapsed = record_timer - now;
+	record_timer = now;
 	
-	// bwprintf(COM2, "BOOTSTRAP buffer: 0x%x, send_index: 0x%x, save_index: 0x%x\n", buffer, buffer_send_index, buffer_save_index);
-	return;
+	while(elapsed > PLREC_TIME_MAX) {
+		plrecordsave(PLREC_IDLE, PLREC_TIME_MAX, '\0');
+		elapsed -= PLREC_TIME_MAX;
+	}
+	plrecordsave(flags, elapsed, c);
+}
+
+void plrecord( PlRecord *ring, unsigned int size ) {
+	record_ring = size > 0 ? ring : 0;
+	record_size = size;
+	record_next = 0;
+	record_total = 0;
+	record_timer = pltimer();
+}
+
+void plrecorded( unsigned int *first, unsigned int *count ) {
+	*count = record_total < record_size ? record_total : record_size;
+	*first = record_size > 0 ? (record_next + record_size - *count) % record_size : 0;
+}
+
+int plreplay( const PlRecord *ring, unsigned int size, unsigned int first, unsigned int count ) {
+	if(ring == 0 || count == 0) return -1;
+	
+	replay_ring = ring;
+	replay_size = size;
+	replay_first = first;
+	replay_count = count;
+	replay_timer = pltimer();
+	
+	// The first record is due right away
+	int i;
+	for(i = 0; i < CHANNEL_MAX; i++) {
+		replay_cursor[i] = 0;
+		replay_time[i] = 0 - ring[first].time;
+	}
+	return 0;
+}
+
+int plreplaying() {
+	return replay_ring != 0;
+}
+
+static int plreplaygetc( int channel, char *c ) {
+	unsigned int cursor = replay_cursor[channel];
+	unsigned int time = replay_time[channel];
+	const PlRecord *record = 0;
+	
+	// Find the next byte received by this channel
+	while(cursor < replay_count) {
+		record = &replay_ring[(replay_first + cursor) % replay_size];
+		if(record->flags == (PLREC_IN | channel)) break;
+		time += record->time;
+		cursor++;
+	}
+	replay_cursor[channel] = cursor;
+	replay_time[channel] = time;
+	
+	if(cursor >= replay_count) {
+		int i;
+		for(i = 0; i < CHANNEL_MAX && (channels[i].lane == 0 || replay_cursor[i] >= replay_count); i++);
+		if(i == CHANNEL_MAX) replay_ring = 0;
+		return 0;
+	}
+	
+	// Not yet received at this time of the recording
+	if(time + record->time > replay_timer - pltimer()) return 0;
+	
+	*c = record->data;
+	replay_cursor[channel] = cursor + 1;
+	replay_time[channel] = time + record->time;
+	return 1;
 }
 
 void plflush( int channel ) {
-	while(plsend(channel) != 0);
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return;
+	do plchinvalidate( ch );
+	while(plchsend( ch ) != 0);
 }
 
 int plsend( int channel ) {
-	if(channel != COM1 && channel != COM2) return -1;
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
+	return plchsend( ch );
+}
+
+// Write a byte of a lane to the UART, which must be ready for it
+static inline void plchwrite( PlChannel *ch, PlLane *lane, char c ) {
+	HAL_WRITE( ch->data, c );
+	ch->status |= TXFF_MASK;	// Taken as full until read again, as it is without the FIFO
+	lane->frame = ch->framer(lane->frame, c);
+	if(record_ring != 0 && replay_ring == 0) plrecordbyte(ch->id, c);
 	
-	// If something is waiting to be sent
-	if(buffer_send_index[channel] != buffer_save_index[channel]) {
-		
-		unsigned int actual_index = (channel * OUTPUT_BUFFER_SIZE) + buffer_send_index[channel];
-		char c = buffer[actual_index];
-		int *flags;
-		char *data;
-		
-		switch( channel ) {
-			case COM1:
-				flags = (int *)( UART1_BASE + UART_FLAG_OFFSET );
-				data = (char *)( UART1_BASE + UART_DATA_OFFSET );
-				// If UART FIFO full or COM1 UART not CTS, return
-				if( (!( *flags & TXFF_MASK )) && ( *flags & CTS_MASK )) *data = c;
-				else return 3;
-				break;
-			case COM2:
-				flags = (int *)( UART2_BASE + UART_FLAG_OFFSET );
-				data = (char *)( UART2_BASE + UART_DATA_OFFSET );
-				// If UART FIFO full, return
-				if( !( *flags & TXFF_MASK ) ) *data = c;
-				else return 2;
-				break;
-			default:
-				return -1;
-				break;
+	// Stat data
+	ch->total_send++;
+}
+
+int plchsend( PlChannel *ch ) {
+	PlLane *bulk = &ch->lanes[PLLANE_BULK];
+	PlLane *interactive = &ch->lanes[PLLANE_INTERACTIVE];
+	PlLane *lane;
+	
+	// If something is waiting to be sent, the interactive lane first, without cutting into a unit
+	if(interactive->send_index != interactive->save_index && bulk->frame == 0) lane = interactive;
+	else if(bulk->send_index != bulk->save_index && interactive->frame == 0) lane = bulk;
+	else return 0;
+	
+	// If UART FIFO full, or no CTS on a flow controlled channel, return
+	unsigned int flags = plchstatus( ch );
+	if(( flags & ch->tx_mask ) != ch->tx_ready) {
+		if(( ch->tx_ready & CTS_MASK ) && !( flags & CTS_MASK ) && !ch->stalling) {
+			ch->stalling = 1;
+			ch->stall_start = pltimer();
 		}
-		
-		buffer[actual_index] = '\0';
-		
-		// Stat data
-		// if(buffer_send_index[channel] > max_send_index) {
-		// 	max_send_index = buffer_send_index[channel];
-		// }
-		total_send[channel]++;
-		
-		unsigned int next_index = (buffer_send_index[channel] + 1) % OUTPUT_BUFFER_SIZE;
-		buffer_send_index[channel] = next_index;
-		
-		return 1;
+		return 2;
 	}
-	return 0;
+	if(ch->stalling) {
+		unsigned int waited = ch->stall_start - pltimer(); // Timer3 counts down
+		if(waited > ch->stall_max) ch->stall_max = waited;
+		if(waited >= PLSTALL_TICKS) ch->stalls++;
+		ch->stalling = 0;
+	}
+	
+	plchwrite( ch, lane, lane->ring[lane->send_index] );
+	
+	if(++lane->send_index == lane->size) lane->send_index = 0;
+	return 1;
 }
 
-int plsave( int channel, char c ) {
-	if(channel != COM1 && channel != COM2) return -1;
-	unsigned int next_index = (buffer_save_index[channel] + 1) % OUTPUT_BUFFER_SIZE;
-	if(next_index != buffer_send_index[channel]) {
-		
-		unsigned int actual_index = (channel * OUTPUT_BUFFER_SIZE) + buffer_save_index[channel];
-		buffer[actual_index] = c;
+int plchsave( PlChannel *ch, char c ) {
+	PlLane *lane = ch->lane;
+	PlLane *other = &ch->lanes[lane == ch->lanes ? PLLANE_INTERACTIVE : PLLANE_BULK];
+	
+	// Nothing waiting, and plchsend would pick this byte next: write it through
+	if(lane->send_index == lane->save_index && other->send_index == other->save_index && other->frame == 0
+		&& ( plchstatus( ch ) & ch->tx_mask ) == ch->tx_ready) {
+		plchwrite( ch, lane, c );
+		ch->total_direct++;
+		return 1;
+	}
+	
+	unsigned int next_index = lane->save_index + 1;
+	if(next_index == lane->size) next_index = 0;
+	if(next_index != lane->send_index) {
+		lane->ring[lane->save_index] = c;
 		
 		// Stat data
-		// if(buffer_save_index[channel] > max_save_index) {
-		// 	max_save_index = buffer_save_index[channel];
-		// }
-		total_save[channel]++;
-		
-		buffer_save_index[channel] = next_index;
+		ch->total_save++;
 		
+		lane->save_index = next_index;
 		return 1;
 	}
 	
 	// No more space in the buffer
-	bwprintf(COM2, "Polling IO: Channel %d buffer is full\n", channel);
+	bwprintf(COM2, "Polling IO: Channel %d lane %d buffer is full\n", ch->id, lane - ch->lanes);
+	return 0;
+}
+
+int plputblock( int channel, const char *block, unsigned int size ) {
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
+	PlLane *lane = ch->lane;
+	unsigned int save_index = lane->save_index;
+	unsigned int room = (lane->send_index + lane->size - save_index - 1) % lane->size;
+	if(size > room) {
+		bwprintf(COM2, "Polling IO: Channel %d lane %d buffer is full\n", ch->id, lane - ch->lanes);
+		return 0;
+	}
+	
+	// Stat data
+	ch->total_save += size;
+	
+	while(size-- > 0) {
+		lane->ring[save_index] = *block++;
+		if(++save_index == lane->size) save_index = 0;
+	}
+	lane->save_index = save_index;
+	return 1;
+}
+
+int plsetframer( int channel, PlFramer framer ) {
+	PlChannel *ch = plchannel( channel );
+	int i;
+	if(ch == 0) return -1;
+	ch->framer = framer != 0 ? framer : plescape;
+	for(i = 0; i < PLLANE_TOTAL; i++) ch->lanes[i].frame = 0;
+	return 0;
+}
+
+unsigned int plchpending( PlChannel *ch, int lane ) {
+	PlLane *l = &ch->lanes[lane];
+	return l->save_index >= l->send_index ? l->save_index - l->send_index : l->save_index + l->size - l->send_index;
+}
+
+unsigned int plchstalled( PlChannel *ch ) {
+	return ch->stalling ? ch->stall_start - pltimer() : 0;
+}
+
+int plsetlane( int channel, int lane ) {
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0 || lane < 0 || lane >= PLLANE_TOTAL) return -1;
+	ch->lane = &ch->lanes[lane];
 	return 0;
 }
 
@@ -135,47 +354,28 @@ int plsave( int channel, char c ) {
  * 	fifos enabled
  */
 int plsetfifo( int channel, int state ) {
-	int *line, buf;
-	switch( channel ) {
-	case COM1:
-		line = (int *)( UART1_BASE + UART_LCRH_OFFSET );
-			break;
-	case COM2:
-			line = (int *)( UART2_BASE + UART_LCRH_OFFSET );
-			break;
-	default:
-			return -1;
-			break;
-	}
-	buf = *line;
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
+	HalReg line = HAL_REG( ch->base, UART_LCRH_OFFSET );
+	int buf = HAL_READ( line );
 	buf = state ? buf | FEN_MASK : buf & ~FEN_MASK;
-	*line = buf;
+	HAL_WRITE( line, buf );
 	return 0;
 }
 
 int plsetspeed( int channel, int speed ) {
-	int *high, *low;
-	switch( channel ) {
-	case COM1:
-		high = (int *)( UART1_BASE + UART_LCRM_OFFSET );
-		low = (int *)( UART1_BASE + UART_LCRL_OFFSET );
-			break;
-	case COM2:
-		high = (int *)( UART2_BASE + UART_LCRM_OFFSET );
-		low = (int *)( UART2_BASE + UART_LCRL_OFFSET );
-			break;
-	default:
-			return -1;
-			break;
-	}
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
+	HalReg high = HAL_REG( ch->base, UART_LCRM_OFFSET );
+	HalReg low = HAL_REG( ch->base, UART_LCRL_OFFSET );
 	switch( speed ) {
 	case 115200:
-		*high = 0x0;
-		*low = 0x3;
+		HAL_WRITE( high, 0x0 );
+		HAL_WRITE( low, 0x3 );
 		return 0;
 	case 2400:
-		*high = 0x0;
-		*low = 0xbf;
+		HAL_WRITE( high, 0x0 );
+		HAL_WRITE( low, 0xbf );
 		return 0;
 	default:
 		return -1;
@@ -183,7 +383,9 @@ int plsetspeed( int channel, int speed ) {
 }
 
 int plputc( int channel, char c ) {
-	return plsave(channel, c);
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
+	return plchsave( ch, c );
 }
 
 char plc2x( char ch ) {
@@ -191,59 +393,68 @@ char plc2x( char ch ) {
 	return 'a' + ch - 10;
 }
 
-int plputx( int channel, char c ) {
+static int plchputx( PlChannel *ch, char c ) {
 	char chh, chl;
 
 	chh = plc2x( c / 16 );
 	chl = plc2x( c % 16 );
-	plputc( channel, chh );
-	return plputc( channel, chl );
+	plchsave( ch, chh );
+	return plchsave( ch, chl );
+}
+
+int plputx( int channel, char c ) {
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
+	return plchputx( ch, c );
 }
 
 int plputr( int channel, unsigned int reg ) {
 	int byte;
-	char *ch = (char *) &reg;
+	char *bytes = (char *) &reg;
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
 
-	for( byte = 3; byte >= 0; byte-- ) plputx( channel, ch[byte] );
-	return plputc( channel, ' ' );
+	for( byte = 3; byte >= 0; byte-- ) plchputx( ch, bytes[byte] );
+	return plchsave( ch, ' ' );
 }
 
 int plputstr( int channel, char *str ) {
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
 	while( *str ) {
-		if( plputc( channel, *str ) < 0 ) return -1;
+		plchsave( ch, *str );
 		str++;
 	}
 	return 0;
 }
 
-void plputw( int channel, int n, char fc, char *bf ) {
-	char ch;
+static void plchputw( PlChannel *ch, int n, char fc, char *bf ) {
+	char c;
 	char *p = bf;
 
 	while( *p++ && n > 0 ) n--;
-	while( n-- > 0 ) plputc( channel, fc );
-	while( ( ch = *bf++ ) ) plputc( channel, ch );
+	while( n-- > 0 ) plchsave( ch, fc );
+	while( ( c = *bf++ ) ) plchsave( ch, c );
+}
+
+void plputw( int channel, int n, char fc, char *bf ) {
+	PlChannel *ch = plchannel( channel );
+	if(ch != 0) plchputw( ch, n, fc, bf );
 }
 
 int plgetc( int channel, char *c ) {
-	int *flags, *data;
-	// unsigned char c;
-
-	switch( channel ) {
-	case COM1:
-		flags = (int *)( UART1_BASE + UART_FLAG_OFFSET );
-		data = (int *)( UART1_BASE + UART_DATA_OFFSET );
-		break;
-	case COM2:
-		flags = (int *)( UART2_BASE + UART_FLAG_OFFSET );
-		data = (int *)( UART2_BASE + UART_DATA_OFFSET );
-		break;
-	default:
-		return -1;
-		break;
-	}
-	if( !( *flags & RXFE_MASK ) ) {
-		*c = *data;
+	PlChannel *ch = plchannel( channel );
+	if(ch == 0) return -1;
+	return plchgetc( ch, c );
+}
+
+int plchgetc( PlChannel *ch, char *c ) {
+	if(replay_ring != 0) return plreplaygetc(ch->id, c);
+
+	if( !( plchstatus( ch ) & RXFE_MASK ) ) {
+		*c = HAL_READ( ch->data );
+		plchinvalidate( ch );	// More may be waiting in the FIFO
+		if(record_ring != 0) plrecordbyte(PLREC_IN | ch->id, *c);
 		return 1;
 	}
 	return 0;
@@ -296,7 +507,7 @@ void pli2a( int num, char *bf ) {
 	plui2a( num, 10, bf );
 }
 
-void plformat ( int channel, char *fmt, va_list va ) {
+static void plformat ( PlChannel *chan, char *fmt, va_list va ) {
 	char bf[12];
 	char ch, lz;
 	int w;
@@ -304,7 +515,7 @@ void plformat ( int channel, char *fmt, va_list va ) {
 
 	while ( ( ch = *(fmt++) ) ) {
 		if ( ch != '%' )
-			plputc( channel, ch );
+			plchsave( chan, ch );
 		else {
 			lz = 0; w = 0;
 			ch = *(fmt++);
@@ -327,25 +538,25 @@ void plformat ( int channel, char *fmt, va_list va ) {
 			switch( ch ) {
 			case 0: return;
 			case 'c':
-				plputc( channel, va_arg( va, char ) );
+				plchsave( chan, (char) va_arg( va, int ) );
 				break;
 			case 's':
-				plputw( channel, w, 0, va_arg( va, char* ) );
+				plchputw( chan, w, 0, va_arg( va, char* ) );
 				break;
 			case 'u':
 				plui2a( va_arg( va, unsigned int ), 10, bf );
-				plputw( channel, w, lz, bf );
+				plchputw( chan, w, lz, bf );
 				break;
 			case 'd':
 				pli2a( va_arg( va, int ), bf );
-				plputw( channel, w, lz, bf );
+				plchputw( chan, w, lz, bf );
 				break;
 			case 'x':
 				plui2a( va_arg( va, unsigned int ), 16, bf );
-				plputw( channel, w, lz, bf );
+				plchputw( chan, w, lz, bf );
 				break;
 			case '%':
-				plputc( channel, ch );
+				plchsave( chan, ch );
 				break;
 			}
 		}
@@ -354,9 +565,31 @@ void plformat ( int channel, char *fmt, va_list va ) {
 
 void plprintf( int channel, char *fmt, ... ) {
 		va_list va;
+		PlChannel *ch = plchannel( channel );
+		if(ch == 0) return;
 
 		va_start(va,fmt);
-		plformat( channel, fmt, va );
+		plformat( ch, fmt, va );
 		va_end(va);
 }
 
+static void pldumpx( int channel, unsigned char c ) {
+	bwputc( channel, plc2x( c / 16 ) );
+	bwputc( channel, plc2x( c % 16 ) );
+}
+
+void pldump( int channel ) {
+	unsigned int i, first, count;
+	plrecorded(&first, &count);
+	
+	bwprintf( channel, "\r\nPLREC %d\r\n", count );
+	for(i = 0; i < count; i++) {
+		const PlRecord *record = &record_ring[(first + i) % record_size];
+		pldumpx( channel, record->time >> 8 );
+		pldumpx( channel, record->time & 0xff );
+		pldumpx( channel, record->flags );
+		pldumpx( channel, record->data );
+		bwputstr( channel, (i % 16 == 15) ? "\r\n" : " " );
+	}
+	bwprintf( channel, "\r\nPLREC END\r\n" );
+}
@@ -0,0 +1,92 @@
+/*
+ * memory.c - stack high-watermark, image sections and buffer accounting
+ */
+
+#include <memory.h>
+
+#define MEMORY_STACK_GUARD 256	// Left unpainted below the frame of the painter
+
+/*
+ * Section bounds from the linker: orex.ld on the board, the default
+ * script of the host linker otherwise
+ */
+#ifdef HOST
+
+extern char __executable_start[], etext[], __data_start[], edata[], __bss_start[], end[];
+#define MEMORY_TEXT_START __executable_start
+#define MEMORY_TEXT_END etext
+#define MEMORY_DATA_START __data_start
+#define MEMORY_DATA_END edata
+#define MEMORY_BSS_START __bss_start
+#define MEMORY_BSS_END end
+#define MEMORY_IMAGE_END end
+
+#else
+
+extern char _TextStart[], _TextEnd[], _DataStart[], _DataEnd[], _BssStart[], _BssEnd[];
+#define MEMORY_TEXT_START _TextStart
+#define MEMORY_TEXT_END _TextEnd
+#define MEMORY_DATA_START _DataStart
+#define MEMORY_DATA_END _DataEnd
+#define MEMORY_BSS_START _BssStart
+#define MEMORY_BSS_END _BssEnd
+#define MEMORY_IMAGE_END _TextEnd
+
+#endif // HOST
+
+static const char *memory_stack_top = 0;
+static volatile unsigned int *memory_stack_bottom = 0;
+
+static MemoryRegion memory_regions[MEMORY_REGION_MAX];
+static int memory_region_total = 0;
+
+void memoryPaintStack(const void *top, unsigned int size) {
+	volatile unsigned int here = 0;
+	const char *bottom = (const char *)top - size;
+	const char *image_end = MEMORY_IMAGE_END;
+	if(bottom < image_end) bottom = image_end;
+
+	// Word aligned, up to just below this frame
+	volatile unsigned int *paint = (volatile unsigned int *)(((unsigned long)bottom + 3) & ~3UL);
+	volatile unsigned int *limit = (volatile unsigned int *)((unsigned long)&here - MEMORY_STACK_GUARD);
+	memory_stack_top = top;
+	memory_stack_bottom = paint;
+	while(paint < limit) *paint++ = MEMORY_STACK_PAINT;
+}
+
+int memoryRegister(const char *name, const void *address, unsigned int size) {
+	if(memory_region_total >= MEMORY_REGION_MAX) return 0;
+	memory_regions[memory_region_total].name = name;
+	memory_regions[memory_region_total].address = address;
+	memory_regions[memory_region_total].size = size;
+	memory_region_total++;
+	return 1;
+}
+
+int memoryRegions(const MemoryRegion **regions) {
+	*regions = memory_regions;
+	return memory_region_total;
+}
+
+int memoryIsStatic(const void *address) {
+	const char *at = address;
+	return (at >= MEMORY_DATA_START && at < MEMORY_DATA_END) || (at >= MEMORY_BSS_START && at < MEMORY_BSS_END);
+}
+
+void memoryUsage(MemoryUsage *usage) {
+	volatile unsigned int here = 0;
+	usage->text = MEMORY_TEXT_END - MEMORY_TEXT_START;
+	usage->data = MEMORY_DATA_END - MEMORY_DATA_START;
+	usage->bss = MEMORY_BSS_END - MEMORY_BSS_START;
+	usage->stack_painted = 0;
+	usage->stack_used = 0;
+	usage->stack_now = 0;
+	if(memory_stack_top == 0) return;
+
+	// The first word that lost its paint is the deepest point reached
+	volatile unsigned int *scan = memory_stack_bottom;
+	while((const char *)scan < memory_stack_top && *scan == MEMORY_STACK_PAINT) scan++;
+	usage->stack_painted = memory_stack_top - (const char *)memory_stack_bottom;
+	usage->stack_used = memory_stack_top - (const char *)scan;
+	usage->stack_now = memory_stack_top - (const char *)&here;
+}
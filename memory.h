@@ -0,0 +1,55 @@
+/*
+ * memory.h - stack high-watermark, image sections and buffer accounting
+ */
+
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#define MEMORY_STACK_PAINT 0xdeadbeef
+#define MEMORY_STACK_PAINT_SIZE (256 * 1024)
+#define MEMORY_REGION_MAX 16
+
+typedef struct MemoryRegion {
+	const char *name;
+	const void *address;
+	unsigned int size;
+} MemoryRegion;
+
+typedef struct MemoryUsage {
+	unsigned int text;
+	unsigned int data;
+	unsigned int bss;
+	unsigned int stack_painted;	// Size of the painted stack, from its top
+	unsigned int stack_used;	// High watermark: deepest point ever reached
+	unsigned int stack_now;	// Depth of the caller
+} MemoryUsage;
+
+/*
+ * Paint size bytes of stack below top with MEMORY_STACK_PAINT, down to the
+ * end of the image at most. top is the highest address of the stack in use,
+ * e.g. the frame address of main(). Call it before anything else.
+ */
+void memoryPaintStack(const void *top, unsigned int size);
+
+/*
+ * Account a structure, e.g. a buffer, under a name
+ * Return: 1 Registered, 0 Too many structures
+ */
+int memoryRegister(const char *name, const void *address, unsigned int size);
+
+/*
+ * Return: number of registered structures, saved into *regions
+ */
+int memoryRegions(const MemoryRegion **regions);
+
+/*
+ * Return: 1 if the address is in .data or .bss, 0 otherwise (on the stack)
+ */
+int memoryIsStatic(const void *address);
+
+/*
+ * Section sizes, and stack usage found by scanning the paint up from the bottom
+ */
+void memoryUsage(MemoryUsage *usage);
+
+#endif // __MEMORY_H__
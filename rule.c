@@ -0,0 +1,105 @@
+/*
+ * rule.c - commands run on sensor edges, chained in a table indexed by edge,
+ * decoder byte and bit
+ */
+
+#include <track.h>
+#include <rule.h>
+
+#define RULE_NONE 0xff
+#define RULE_BYTE_TOTAL (TRACK_SENSOR_TOTAL / 8)
+
+Rule rules[RULE_MAX];
+
+// First rule of each edge and bit of each decoder byte, RULE_NONE if none
+static unsigned char rule_first[2][RULE_BYTE_TOTAL][8];
+static unsigned char rule_free = RULE_NONE;
+static int rule_total = 0;
+static RuleFire rule_fire = 0;
+
+void ruleBootstrap(RuleFire fire) {
+	int i, j;
+	rule_fire = fire;
+	rule_total = 0;
+	for(i = 0; i < RULE_BYTE_TOTAL; i++) {
+		for(j = 0; j < 8; j++) {
+			rule_first[COMMAND_EDGE_RISING][i][j] = RULE_NONE;
+			rule_first[COMMAND_EDGE_FALLING][i][j] = RULE_NONE;
+		}
+	}
+	rule_free = RULE_NONE;
+	for(i = RULE_MAX - 1; i >= 0; i--) {
+		rules[i].next = rule_free;
+		rule_free = i;
+	}
+}
+
+// The controller sends the sensors of a byte from bit 7 down
+static inline unsigned char *ruleSlot(int sensor, int edge) {
+	return &rule_first[edge][sensor / 8][7 - sensor % 8];
+}
+
+int ruleAdd(int sensor, int edge, const CommandRecord *action) {
+	int i;
+	if(rule_free == RULE_NONE) return 0;
+
+	// Removing its own rules would free the chain ruleFireBits is walking
+	if(action->opcode == COMMAND_RULE_OFF) {
+		for(i = 0; i < action->count; i++) {
+			if(action->operands[i][0] == sensor) return 0;
+		}
+	}
+
+	unsigned char *slot = ruleSlot(sensor, edge);
+	i = rule_free;
+	rule_free = rules[i].next;
+
+	rules[i].action = *action;
+	rules[i].sensor = sensor;
+	rules[i].edge = edge;
+
+	// Appended, rules of a sensor fire in the order they were added
+	rules[i].next = RULE_NONE;
+	while(*slot != RULE_NONE) slot = &rules[*slot].next;
+	*slot = i;
+	rule_total++;
+	return 1;
+}
+
+int ruleRemove(int sensor) {
+	int edge, removed = 0;
+	for(edge = COMMAND_EDGE_RISING; edge <= COMMAND_EDGE_FALLING; edge++) {
+		unsigned char *slot = ruleSlot(sensor, edge);
+		while(*slot != RULE_NONE) {
+			int i = *slot;
+			*slot = rules[i].next;
+			rules[i].next = rule_free;
+			rule_free = i;
+			removed++;
+		}
+	}
+	rule_total -= removed;
+	return removed;
+}
+
+int ruleTotal() {
+	return rule_total;
+}
+
+// The next rule is read before the action runs; ruleAdd keeps an action from removing its own chain
+static inline void ruleFireBits(const unsigned char *first, unsigned char bits, unsigned int arrived) {
+	int bit, i, next;
+	for(bit = 0; bits != 0; bit++, bits >>= 1) {
+		if((bits & 1) == 0) continue;
+		for(i = first[bit]; i != RULE_NONE; i = next) {
+			next = rules[i].next;
+			rule_fire(&rules[i].action, arrived);
+		}
+	}
+}
+
+void ruleDispatch(unsigned int index, char rising, char falling, unsigned int arrived) {
+	if(rule_total == 0) return;
+	if(rising) ruleFireBits(rule_first[COMMAND_EDGE_RISING][index], rising, arrived);
+	if(falling) ruleFireBits(rule_first[COMMAND_EDGE_FALLING][index], falling, arrived);
+}
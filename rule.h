@@ -0,0 +1,50 @@
+/*
+ * rule.h - commands run on sensor edges, e.g. "on A5 rising: sw 12 C"
+ *
+ * Rules are chained in a table indexed by edge, decoder byte and bit, so a
+ * sensor byte finds its rules without walking the others.
+ */
+
+#ifndef __RULE_H__
+#define __RULE_H__
+
+#include <command.h>
+
+#define RULE_MAX 32
+
+// Run the action of a rule, arrived is the debug timer at the arrival of the sensor byte
+typedef void (*RuleFire)(const CommandRecord *action, unsigned int arrived);
+
+typedef struct Rule {
+	CommandRecord action;
+	unsigned char sensor;	// Track node index
+	unsigned char edge;	// COMMAND_EDGE_*
+	unsigned char next;	// Of the same sensor and edge, or of the free rules
+} Rule;
+
+extern Rule rules[RULE_MAX];
+
+void ruleBootstrap(RuleFire fire);
+
+/*
+ * Return: 1 Added, 0 The table is full, or the action is an off of the
+ *         sensor itself, which would remove the rules while they fire
+ */
+int ruleAdd(int sensor, int edge, const CommandRecord *action);
+
+/*
+ * Remove every rule of a sensor
+ * Return: rules removed
+ */
+int ruleRemove(int sensor);
+
+// Rules in the table
+int ruleTotal();
+
+/*
+ * Fire the rules of the bits set and cleared in a decoder byte, LSB first as
+ * read from the controller
+ */
+void ruleDispatch(unsigned int index, char rising, char falling, unsigned int arrived);
+
+#endif // __RULE_H__
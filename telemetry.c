@@ -0,0 +1,137 @@
+/*
+ * telemetry.c - framed binary telemetry on a plio channel, for headless mode,
+ * and binary command frames coming the other way
+ */
+
+#include <plio.h>
+#include <telemetry.h>
+
+static int telemetry_channel = COM2;
+static unsigned char telemetry_sequence = 0;
+
+unsigned int telemetry_frames = 0;
+unsigned int telemetry_bytes = 0;
+unsigned int telemetry_dropped = 0;
+
+void telemetryBootstrap(int channel) {
+	telemetry_channel = channel;
+	telemetry_sequence = 0;
+	telemetry_frames = 0;
+	telemetry_bytes = 0;
+	telemetry_dropped = 0;
+}
+
+/*
+ * State: 0 between frames, then the header bytes sent, then TELEMETRY_HEADER
+ * plus the payload and checksum bytes left
+ */
+unsigned int telemetryFramer(unsigned int state, char c) {
+	if(state == 0) return (unsigned char)c == TELEMETRY_START;
+	if(state < TELEMETRY_HEADER - 1) return state + 1;
+	if(state == TELEMETRY_HEADER - 1) return TELEMETRY_HEADER + (unsigned char)c + 1;
+	return state - 1 == TELEMETRY_HEADER ? 0 : state - 1;
+}
+
+int telemetrySend(int type, const unsigned char *payload, unsigned int size) {
+	PlChannel *ch = plchannel(telemetry_channel);
+	if(size > TELEMETRY_PAYLOAD_MAX) return -1;
+
+	// The whole frame or nothing, a partial one would throw the readers and the framer off
+	PlLane *lane = ch->lane;
+	if(lane->size - 1 - plchpending(ch, lane - ch->lanes) < TELEMETRY_HEADER + size + 1) {
+		telemetry_dropped++;
+		return 0;
+	}
+
+	unsigned char sum = type + telemetry_sequence + size;
+	unsigned int i;
+	plchsave(ch, TELEMETRY_START);
+	plchsave(ch, type);
+	plchsave(ch, telemetry_sequence);
+	plchsave(ch, size);
+	for(i = 0; i < size; i++) {
+		plchsave(ch, payload[i]);
+		sum += payload[i];
+	}
+	plchsave(ch, -sum);
+
+	telemetry_sequence++;
+	telemetry_frames++;
+	telemetry_bytes += TELEMETRY_HEADER + size + 1;
+	return 0;
+}
+
+static inline unsigned char *telemetryPut16(unsigned char *payload, unsigned int value) {
+	payload[0] = value;
+	payload[1] = value >> 8;
+	return payload + 2;
+}
+
+static inline unsigned char *telemetryPut32(unsigned char *payload, unsigned int value) {
+	payload = telemetryPut16(payload, value);
+	return telemetryPut16(payload, value >> 16);
+}
+
+void telemetryHello() {
+	unsigned char payload[1] = { TELEMETRY_VERSION };
+	telemetrySend(TELEMETRY_HELLO, payload, sizeof(payload));
+}
+
+void telemetryStats(const TelemetryStats *stats) {
+	unsigned char payload[TELEMETRY_PAYLOAD_MAX];
+	unsigned char *end = payload;
+	end = telemetryPut32(end, stats->tick);
+	end = telemetryPut32(end, stats->loops);
+	*end++ = stats->queued;
+	end = telemetryPut16(end, stats->dropped);
+	end = telemetryPut16(end, stats->stalls);
+	*end++ = stats->stalled;
+	telemetrySend(TELEMETRY_STATS, payload, end - payload);
+}
+
+void telemetrySensor(unsigned int index, char data, char tripped) {
+	unsigned char payload[3] = { index, data, tripped };
+	telemetrySend(TELEMETRY_SENSOR, payload, sizeof(payload));
+}
+
+void telemetrySwitch(int id, char state) {
+	unsigned char payload[2] = { id, state };
+	telemetrySend(TELEMETRY_SWITCH, payload, sizeof(payload));
+}
+
+static void telemetrySendInteractive(int type, const unsigned char *payload, unsigned int size) {
+	plsetlane(telemetry_channel, PLLANE_INTERACTIVE);
+	telemetrySend(type, payload, size);
+	plsetlane(telemetry_channel, PLLANE_BULK);
+}
+
+void telemetryAck(int result, unsigned int parse_us) {
+	unsigned char payload[3];
+	payload[0] = result;
+	telemetryPut16(payload + 1, parse_us);
+	telemetrySendInteractive(TELEMETRY_ACK, payload, sizeof(payload));
+}
+
+void telemetryFrameAck(unsigned int sequence, unsigned int done, unsigned int status, unsigned int decode_us) {
+	unsigned char payload[5] = { sequence, done, status };
+	telemetryPut16(payload + 3, decode_us);
+	telemetrySendInteractive(TELEMETRY_FRAME_ACK, payload, sizeof(payload));
+}
+
+int telemetryReceive(TelemetryReceiver *rx, char c) {
+	unsigned int index = rx->received++;
+	if(index == 0) {
+		rx->sum = 0;
+		return 0;
+	}
+	rx->sum += c;
+	if(index == 1) rx->type = c;
+	else if(index == 2) rx->sequence = c;
+	else if(index == 3) rx->size = c;
+	else if(index < TELEMETRY_HEADER + rx->size) rx->payload[index - TELEMETRY_HEADER] = c;
+	else {
+		rx->received = 0;
+		return rx->sum == 0 ? 1 : -1;
+	}
+	return 0;
+}
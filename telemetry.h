@@ -0,0 +1,103 @@
+/*
+ * telemetry.h - framed binary telemetry on a plio channel, for headless mode,
+ * and binary command frames coming the other way
+ *
+ * Every frame is: TELEMETRY_START, type, sequence, payload size, payload,
+ * checksum. The sequence counts frames modulo 256, so a reader can tell
+ * frames were lost. The checksum makes the sum of the bytes from the type to
+ * the checksum 0 modulo 256. TELEMETRY_START is not escaped in the payload:
+ * a reader out of sync skips to the next start byte that gives a valid frame.
+ * Integers are little endian.
+ */
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#define TELEMETRY_START 0xa5
+#define TELEMETRY_HEADER 4	// Start, type, sequence, payload size
+#define TELEMETRY_PAYLOAD_MAX 16
+#define TELEMETRY_VERSION 1
+
+/* Frame types, and their payload */
+#define TELEMETRY_HELLO 1	// version; first frame after entering headless mode
+#define TELEMETRY_STATS 2	// tick u32, loops u32 since the last, queued u8, dropped u16, stalls u16, stalled u8
+#define TELEMETRY_SENSOR 3	// decoder byte index, data, bits newly set
+#define TELEMETRY_SWITCH 4	// switch id, 'S', 'C' or '?'
+#define TELEMETRY_ACK 5	// result s8 (COMMAND_RESULT_*), parse time in us u16
+#define TELEMETRY_FRAME_ACK 6	// sequence of the command frame, operations done u8, TELEMETRY_STATUS_*, decode time in us u16
+
+/* Frame types received */
+#define TELEMETRY_COMMANDS 16	// Operations, see commandDecode
+
+/* Outcome of a command frame */
+#define TELEMETRY_STATUS_DONE 0	// Every operation done
+#define TELEMETRY_STATUS_CHECKSUM 1	// Corrupt, nothing done
+#define TELEMETRY_STATUS_INVALID 2	// Malformed, or an invalid operation, nothing done
+#define TELEMETRY_STATUS_BUSY 3	// No room in the train command queue, nothing done
+#define TELEMETRY_STATUS_FAILED 4	// An operation cannot run, e.g. no route, nothing done
+#define TELEMETRY_STATUS_TIMEOUT 5	// Incomplete, nothing done
+
+typedef struct TelemetryStats {
+	unsigned int tick;	// 1/100 sec since boot
+	unsigned int loops;	// Polling loop cycles since the last stats
+	unsigned char queued;	// Train commands waiting in the queue
+	unsigned short dropped;	// Train commands dropped, queue full
+	unsigned short stalls;	// CTS stalls of COM1
+	unsigned char stalled;	// COM1 is stalled now
+} TelemetryStats;
+
+/*
+ * Frame being received. TELEMETRY_START cannot be typed, so it starts a
+ * frame even in the middle of a text line.
+ */
+typedef struct TelemetryReceiver {
+	unsigned int received;	// Bytes of the frame so far, 0 when waiting for TELEMETRY_START
+	unsigned char sum;
+	unsigned char type;
+	unsigned char sequence;
+	unsigned char size;
+	unsigned char payload[256];
+} TelemetryReceiver;
+
+// Frames and bytes written, and frames dropped for lack of room in the lane, since the bootstrap
+extern unsigned int telemetry_frames;
+extern unsigned int telemetry_bytes;
+extern unsigned int telemetry_dropped;
+
+void telemetryBootstrap(int channel);
+
+/*
+ * Framer of the channel while in headless mode, see plsetframer: the
+ * interactive lane only cuts in between frames
+ */
+unsigned int telemetryFramer(unsigned int state, char c);
+
+/*
+ * Frame a payload into the lane of the channel being written to, whole or
+ * not at all
+ * Return: -1 Payload too large, 0 Queued, or dropped if the lane is full
+ */
+int telemetrySend(int type, const unsigned char *payload, unsigned int size);
+
+void telemetryHello();
+
+void telemetryStats(const TelemetryStats *stats);
+
+void telemetrySensor(unsigned int index, char data, char tripped);
+
+void telemetrySwitch(int id, char state);
+
+// Sent through the interactive lane, ahead of the stats and sensor frames queued
+void telemetryAck(int result, unsigned int parse_us);
+
+// Sent through the interactive lane too
+void telemetryFrameAck(unsigned int sequence, unsigned int done, unsigned int status, unsigned int decode_us);
+
+/*
+ * Take one byte of a frame, starting with TELEMETRY_START
+ * Return: 1 Frame complete, 0 Incomplete, -1 Complete but corrupt. The
+ * receiver is ready for the next frame after a complete one.
+ */
+int telemetryReceive(TelemetryReceiver *rx, char c);
+
+#endif // __TELEMETRY_H__
@@ -0,0 +1,61 @@
+/*
+ * trace.c - binary trace ring and its formatting
+ */
+
+#include <bwio.h>
+#include <trace.h>
+
+#ifdef TRACE_ENABLE
+TraceRecord trace_ring[TRACE_RING_SIZE];
+unsigned int trace_next = 0;
+#endif // TRACE_ENABLE
+
+static const char *trace_formats[TRACE_EVENT_TOTAL] = {
+	"?",
+	"push %d delay %d",
+	"queue full, reject %d commands, %d free",
+	"send %d pause %d",
+	"resume, pause left %d",
+	"flush sensor byte 0x%x",
+	"sensor request %d",
+	"sensor byte %d = 0x%x",
+	"sensor %c%d",
+	"sensor timeout after %d",
+	"command %d with %d operands",
+	"invalid command, parsed in %d",
+	"uart 0x%x = 0x%x",
+	"timer 0x%x control 0x%x",
+	"train %d reversed after %d",
+	"urgent %d",
+	"com1 stalled %d, %d stalls",
+	"frame %d status %d",
+	"rule fired, opcode %d, %d commands",
+	"rule command %d sent after %dus",
+};
+
+const TraceRecord *traceRecent(unsigned int back) {
+#ifdef TRACE_ENABLE
+	if(back >= TRACE_RING_SIZE || back >= trace_next) return 0;
+	return &trace_ring[(trace_next - 1 - back) & (TRACE_RING_SIZE - 1)];
+#else
+	return 0;
+#endif // TRACE_ENABLE
+}
+
+const char *traceFormat(int event) {
+	if(event <= 0 || event >= TRACE_EVENT_TOTAL) return trace_formats[0];
+	return trace_formats[event];
+}
+
+void traceDump(int channel) {
+	int back;
+	const TraceRecord *record;
+	bwprintf(channel, "TRACE\n");
+	for(back = TRACE_RING_SIZE - 1; back >= 0; back--) {
+		if((record = traceRecent(back)) == 0) continue;
+		bwprintf(channel, "%u ", record->time);
+		bwprintf(channel, (char *)traceFormat(record->event), record->a, record->b);
+		bwputc(channel, '\n');
+	}
+	bwprintf(channel, "TRACE\n");
+}
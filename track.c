@@ -0,0 +1,167 @@
+/*
+ * track.c - track graph of the Märklin layout and route finding
+ */
+
+#include <track.h>
+
+#define S(decoder, number) TRACK_SENSOR(decoder, number)
+#define BR(id) TRACK_BRANCH(id)
+#define MR(id) TRACK_MERGE(id)
+#define STR TRACK_DIR_STRAIGHT
+#define CUR TRACK_DIR_CURVED
+
+/*
+ * PLACEHOLDER: this is not the real track A or B. It is a made-up topology
+ * of two loops with sidings, using the odd sensors only, so that routes can
+ * be found and the host simulation has a graph to drive trains on. The
+ * simulation uses this same table, so it only checks the table against
+ * itself. Until the real track data replaces it (and
+ * TRACK_LAYOUT_PLACEHOLDER goes to 0), route throws the wrong switches on
+ * the hardware.
+ *
+ * Layout in clockwise heading. The counter-clockwise heading is derived in
+ * trackBootstrap(). 'direction' is the switch direction used by the edge:
+ * the leaving direction of a branch, or the entering direction of a merge.
+ */
+typedef struct TrackEdge {
+	short from;
+	short to;
+	char direction;
+} TrackEdge;
+
+static const TrackEdge track_layout[] = {
+	/* Outer loop */
+	{S('A', 1), BR(1), STR},	{BR(1), S('A', 3), STR},	{S('A', 3), MR(2), STR},
+	{MR(2), S('A', 5), STR},	{S('A', 5), BR(3), STR},	{BR(3), S('A', 7), STR},
+	{S('A', 7), MR(4), STR},	{MR(4), S('A', 9), STR},	{S('A', 9), BR(5), STR},
+	{BR(5), S('A', 11), STR},	{S('A', 11), MR(6), STR},	{MR(6), S('A', 13), STR},
+	{S('A', 13), BR(7), STR},	{BR(7), S('A', 15), STR},	{S('A', 15), MR(8), STR},
+	{MR(8), S('B', 1), STR},	{S('B', 1), BR(9), STR},	{BR(9), S('B', 3), STR},
+	{S('B', 3), MR(10), STR},	{MR(10), S('B', 5), STR},	{S('B', 5), BR(153), STR},
+	{BR(153), S('B', 7), STR},	{S('B', 7), MR(154), STR},	{MR(154), S('B', 9), STR},
+	{S('B', 9), S('A', 1), STR},
+	/* Outer sidings */
+	{BR(1), S('B', 11), CUR},	{S('B', 11), MR(2), CUR},
+	{BR(3), S('B', 13), CUR},	{S('B', 13), MR(4), CUR},
+	{BR(5), S('B', 15), CUR},	{S('B', 15), MR(6), CUR},
+	{BR(7), S('E', 5), CUR},	{S('E', 5), MR(8), CUR},
+	{BR(9), S('E', 7), CUR},	{S('E', 7), MR(10), CUR},
+	/* Inner loop */
+	{S('C', 1), BR(11), STR},	{BR(11), S('C', 3), STR},	{S('C', 3), MR(12), STR},
+	{MR(12), S('C', 5), STR},	{S('C', 5), BR(13), STR},	{BR(13), S('C', 7), STR},
+	{S('C', 7), MR(14), STR},	{MR(14), S('C', 9), STR},	{S('C', 9), BR(15), STR},
+	{BR(15), S('C', 11), STR},	{S('C', 11), MR(16), STR},	{MR(16), S('C', 13), STR},
+	{S('C', 13), BR(17), STR},	{BR(17), S('C', 15), STR},	{S('C', 15), MR(18), STR},
+	{MR(18), S('D', 1), STR},	{S('D', 1), MR(155), STR},	{MR(155), S('D', 3), STR},
+	{S('D', 3), BR(156), STR},	{BR(156), S('D', 5), STR},	{S('D', 5), S('C', 1), STR},
+	/* Inner sidings */
+	{BR(11), S('D', 7), CUR},	{S('D', 7), MR(12), CUR},
+	{BR(13), S('D', 9), CUR},	{S('D', 9), MR(14), CUR},
+	{BR(15), S('D', 11), CUR},	{S('D', 11), MR(16), CUR},
+	{BR(17), S('D', 13), CUR},	{S('D', 13), MR(18), CUR},
+	/* Center crossovers */
+	{BR(153), S('E', 1), CUR},	{S('E', 1), MR(155), CUR},
+	{BR(156), S('E', 3), CUR},	{S('E', 3), MR(154), CUR},
+};
+
+#define TRACK_LAYOUT_TOTAL (sizeof(track_layout) / sizeof(TrackEdge))
+
+TrackNode track_nodes[TRACK_NODE_TOTAL];
+
+static short route_parent[TRACK_NODE_TOTAL];
+static char route_parent_dir[TRACK_NODE_TOTAL];
+static short route_queue[TRACK_NODE_TOTAL];
+
+static void linkNode(int from, int to, int direction) {
+	TrackNode *node = &track_nodes[from];
+	node->edge[node->type == TRACK_NODE_BRANCH ? direction : TRACK_DIR_AHEAD] = to;
+}
+
+void trackBootstrap() {
+	int i;
+	for(i = 0; i < TRACK_NODE_TOTAL; i++) {
+		TrackNode *node = &track_nodes[i];
+		node->edge[0] = TRACK_NONE;
+		node->edge[1] = TRACK_NONE;
+		if(i < TRACK_SENSOR_TOTAL) {
+			// A1 and A2 are the two headings of the same sensor
+			node->type = TRACK_NODE_SENSOR;
+			node->id = (i % TRACK_DECODER_SENSORS) + 1;
+			node->reverse = i ^ 1;
+		}
+		else {
+			int index = (i - TRACK_SENSOR_TOTAL) % TRACK_SWITCH_TOTAL;
+			node->type = i < TRACK_SENSOR_TOTAL + TRACK_SWITCH_TOTAL ? TRACK_NODE_BRANCH : TRACK_NODE_MERGE;
+			node->id = index < 18 ? index + 1 : index - 18 + 153;
+			node->reverse = node->type == TRACK_NODE_BRANCH ? i + TRACK_SWITCH_TOTAL : i - TRACK_SWITCH_TOTAL;
+		}
+	}
+
+	// Link each edge in both headings
+	for(i = 0; i < TRACK_LAYOUT_TOTAL; i++) {
+		const TrackEdge *edge = &track_layout[i];
+		linkNode(edge->from, edge->to, edge->direction);
+		linkNode(track_nodes[edge->to].reverse, track_nodes[edge->from].reverse, edge->direction);
+	}
+}
+
+int trackSensorIndex(const char *name) {
+	char decoder = *name++;
+	if(decoder >= 'a' && decoder <= 'z') decoder = decoder - 'a' + 'A';
+	if(decoder < 'A' || decoder >= 'A' + TRACK_DECODER_TOTAL) return TRACK_NONE;
+
+	int number = 0;
+	if(*name == '\0') return TRACK_NONE;
+	while(*name >= '0' && *name <= '9') number = number * 10 + (*name++ - '0');
+	if(*name != '\0' && *name != ' ' && *name != '\n' && *name != '\r') return TRACK_NONE;
+	if(number < 1 || number > TRACK_DECODER_SENSORS) return TRACK_NONE;
+
+	return TRACK_SENSOR(decoder, number);
+}
+
+int trackRoute(int from, int to, TrackSwitchSetting *settings) {
+	int i, head = 0, tail = 0;
+	for(i = 0; i < TRACK_NODE_TOTAL; i++) route_parent[i] = TRACK_NONE;
+
+	// Breadth first search, so the path visit the fewest nodes
+	route_parent[from] = from;
+	route_queue[tail++] = from;
+	while(head < tail && route_parent[to] == TRACK_NONE) {
+		int current = route_queue[head++];
+		for(i = 0; i < 2; i++) {
+			int next = track_nodes[current].edge[i];
+			if(next == TRACK_NONE || route_parent[next] != TRACK_NONE) continue;
+			route_parent[next] = current;
+			route_parent_dir[next] = i;
+			route_queue[tail++] = next;
+		}
+	}
+	if(route_parent[to] == TRACK_NONE) return -1;
+
+	// Walk back from the destination, collecting the switches on the path
+	int count = 0, current = to;
+	while(current != from) {
+		int parent = route_parent[current];
+		if(track_nodes[current].type == TRACK_NODE_MERGE && count < TRACK_ROUTE_MAX) {
+			// Trailing switch must point to the track we come from
+			const TrackNode *branch = &track_nodes[track_nodes[current].reverse];
+			settings[count].id = track_nodes[current].id;
+			settings[count].direction = branch->edge[TRACK_DIR_CURVED] == track_nodes[parent].reverse ? TRACK_DIR_CURVED : TRACK_DIR_STRAIGHT;
+			count++;
+		}
+		if(track_nodes[parent].type == TRACK_NODE_BRANCH && count < TRACK_ROUTE_MAX) {
+			settings[count].id = track_nodes[parent].id;
+			settings[count].direction = route_parent_dir[current];
+			count++;
+		}
+		current = parent;
+	}
+
+	// Reverse into path order
+	for(i = 0; i < count / 2; i++) {
+		TrackSwitchSetting temp = settings[i];
+		settings[i] = settings[count - 1 - i];
+		settings[count - 1 - i] = temp;
+	}
+	return count;
+}
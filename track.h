@@ -0,0 +1,80 @@
+/*
+ * track.h - track graph of the Märklin layout
+ */
+
+#ifndef __TRACK_H__
+#define __TRACK_H__
+
+#define TRACK_NODE_SENSOR 1
+#define TRACK_NODE_BRANCH 2
+#define TRACK_NODE_MERGE 3
+
+#define TRACK_DIR_AHEAD 0
+#define TRACK_DIR_STRAIGHT 0
+#define TRACK_DIR_CURVED 1
+
+#define TRACK_NONE -1
+
+/*
+ * 1 while track_layout in track.c is the placeholder below rather than the
+ * real track A or B: routes are then not valid on the hardware, and only
+ * the host build, whose simulation runs on the same layout, takes them
+ */
+#define TRACK_LAYOUT_PLACEHOLDER 1
+
+#if TRACK_LAYOUT_PLACEHOLDER && !defined(HOST)
+#define TRACK_ROUTE_ALLOWED 0
+#else
+#define TRACK_ROUTE_ALLOWED 1
+#endif
+
+#define TRACK_DECODER_TOTAL 5
+#define TRACK_DECODER_SENSORS 16
+#define TRACK_SENSOR_TOTAL (TRACK_DECODER_TOTAL * TRACK_DECODER_SENSORS)
+#define TRACK_SWITCH_TOTAL 22
+#define TRACK_NODE_TOTAL (TRACK_SENSOR_TOTAL + TRACK_SWITCH_TOTAL * 2)
+#define TRACK_ROUTE_MAX TRACK_SWITCH_TOTAL
+
+/* Node index of each kind of node */
+#define TRACK_SWITCH_VALID(id) (((id) >= 1 && (id) <= 18) || ((id) >= 153 && (id) <= 156))
+#define TRACK_SWITCH_INDEX(id) ((id) > 18 ? (id) - 153 + 18 : (id) - 1)
+#define TRACK_SENSOR(decoder, number) (((decoder) - 'A') * TRACK_DECODER_SENSORS + (number) - 1)
+#define TRACK_BRANCH(id) (TRACK_SENSOR_TOTAL + TRACK_SWITCH_INDEX(id))
+#define TRACK_MERGE(id) (TRACK_SENSOR_TOTAL + TRACK_SWITCH_TOTAL + TRACK_SWITCH_INDEX(id))
+
+/*
+ * A directed node of the track. Each physical sensor is two nodes (one per
+ * heading), each physical switch is a branch node and a merge node.
+ * Branches leave through edge[TRACK_DIR_STRAIGHT] or edge[TRACK_DIR_CURVED],
+ * every other node leaves through edge[TRACK_DIR_AHEAD].
+ */
+typedef struct TrackNode {
+	char type;
+	unsigned char id;
+	short reverse;
+	short edge[2];
+} TrackNode;
+
+typedef struct TrackSwitchSetting {
+	unsigned char id;
+	char direction;
+} TrackSwitchSetting;
+
+extern TrackNode track_nodes[TRACK_NODE_TOTAL];
+
+void trackBootstrap();
+
+/*
+ * Parse a sensor name, e.g. "A5" or "c13", ended by '\0', space or EOL
+ * Return: node index of the sensor, TRACK_NONE if invalid
+ */
+int trackSensorIndex(const char *name);
+
+/*
+ * Find the shortest path from one node to another without reversing
+ * Return: number of switch settings saved into settings (in path order),
+ *         -1 if there is no such path
+ */
+int trackRoute(int from, int to, TrackSwitchSetting *settings);
+
+#endif // __TRACK_H__
@@ -0,0 +1,164 @@
+/*
+ * train.c - per-train state table, speed profiles and the reverse sequence
+ *
+ * Each train runs its own sequence, stepped by trainPoll() when due, so a
+ * train waiting to stop never holds up the commands of the others in the
+ * train command queue.
+ */
+
+#include <train.h>
+#include <trace.h>
+
+#define TRAIN_BEFORE(now, due) ((int)((now) - (due)) < 0)
+
+/*
+ * Rough values of the models on the track, by eye; the first entry is the
+ * default. 35 slows down on its own, 48 stops dead then sits for a second.
+ */
+static const TrainProfile train_profiles[] = {
+	{0, 50, 15, 2, 25},
+	{35, 30, 20, 3, 30},
+	{48, 100, 0, 2, 20},
+};
+
+#define TRAIN_PROFILE_TOTAL (sizeof(train_profiles) / sizeof(TrainProfile))
+
+TrainState train_states[TRAIN_NUMBER_MAX + 1];
+
+// Trains in a sequence, so that a poll does not walk the whole table
+static unsigned char train_active[TRAIN_NUMBER_MAX];
+static int train_active_total = 0;
+static TrainSend train_send = 0;
+
+void trainBootstrap(TrainSend send) {
+	int i, j;
+	train_send = send;
+	train_active_total = 0;
+	for(i = 0; i <= TRAIN_NUMBER_MAX; i++) {
+		TrainState *state = &train_states[i];
+		state->state = TRAIN_STATE_IDLE;
+		state->sent = 0;
+		state->target = 0;
+		state->function = 0;
+		state->reversed = 0;
+		state->reverse_pending = 0;
+		state->stop_ticks = 0;
+		state->due = 0;
+		state->last = 0;
+		state->profile = &train_profiles[0];
+		for(j = 1; j < TRAIN_PROFILE_TOTAL; j++) {
+			if(train_profiles[j].number == i) state->profile = &train_profiles[j];
+		}
+	}
+}
+
+static void trainActivate(int train, int state) {
+	if(train_states[train].state == TRAIN_STATE_IDLE) train_active[train_active_total++] = train;
+	train_states[train].state = state;
+}
+
+static int trainSendSpeed(int train, int speed, unsigned int now) {
+	if(!train_send(speed, train)) return 0;
+	train_states[train].last = now;
+	return 1;
+}
+
+// Return: 1 if the sequence is over
+static int trainStep(int train, unsigned int now) {
+	TrainState *state = &train_states[train];
+	const TrainProfile *profile = state->profile;
+	int level = state->sent & TRAIN_SPEED_LEVEL;
+	if(TRAIN_BEFORE(now, state->due)) return 0;
+
+	if(state->state == TRAIN_STATE_STOPPING) {
+		if(level > 0) {
+			if(!trainSendSpeed(train, state->function, now)) return 0;
+			state->sent = state->function;
+			state->due = now + state->stop_ticks;
+			return 0;
+		}
+		if(state->reverse_pending) {
+			if(!trainSendSpeed(train, TRAIN_SPEED_REVERSE | state->function, now)) return 0;
+			state->reversed ^= 1;
+			state->reverse_pending = 0;
+			TRACE(TRACE_TRAIN_REVERSE, train, state->stop_ticks);
+		}
+		state->state = TRAIN_STATE_RAMP;
+		if(state->target == 0 && state->sent == state->function) return 1;
+		state->due = now + 1;
+		return 0;
+	}
+
+	// Ramp up by the profile, anything else at once
+	int next = state->target;
+	if(next > level && profile->ramp_levels > 0 && next - level > profile->ramp_levels) next = level + profile->ramp_levels;
+	if(!trainSendSpeed(train, next | state->function, now)) return 0;
+	state->sent = next | state->function;
+	state->due = now + profile->ramp_ticks;
+	return next == state->target;
+}
+
+/*
+ * Step the train just commanded, not the others: its bytes go to whichever
+ * lane of the queue the command came through, e.g. the rule lane
+ */
+static void trainStepNow(int train, unsigned int now) {
+	int i;
+	if(!trainStep(train, now)) return;
+	train_states[train].state = TRAIN_STATE_IDLE;
+	for(i = 0; i < train_active_total; i++) {
+		if(train_active[i] == train) {
+			train_active[i] = train_active[--train_active_total];
+			return;
+		}
+	}
+}
+
+void trainSpeed(int train, int speed, unsigned int now) {
+	TrainState *state = &train_states[train];
+	if((speed & TRAIN_SPEED_LEVEL) == TRAIN_SPEED_REVERSE) {
+		state->function = speed & TRAIN_SPEED_FUNCTION;
+		trainReverse(train, now);
+		return;
+	}
+
+	state->target = speed & TRAIN_SPEED_LEVEL;
+	state->function = speed & TRAIN_SPEED_FUNCTION;
+	if(state->state == TRAIN_STATE_STOPPING) return; // Re-accelerates to the new target once reversed
+
+	// Sent right away, unless it speeds up a ramp in progress
+	if(state->state == TRAIN_STATE_IDLE || state->target <= (state->sent & TRAIN_SPEED_LEVEL)) state->due = now;
+	trainActivate(train, TRAIN_STATE_RAMP);
+	trainStepNow(train, now);
+}
+
+void trainReverse(int train, unsigned int now) {
+	TrainState *state = &train_states[train];
+	if(state->state == TRAIN_STATE_STOPPING) {
+		state->reverse_pending ^= 1;
+		return;
+	}
+
+	// Come back to the level it was heading to, not the one it had ramped to
+	int level = state->sent & TRAIN_SPEED_LEVEL;
+	state->stop_ticks = level > 0 ? state->profile->stop_base + state->profile->stop_per_level * level : 0;
+	state->reverse_pending = 1;
+	trainActivate(train, TRAIN_STATE_STOPPING);
+	state->due = now;
+	trainStepNow(train, now);
+}
+
+void trainPoll(unsigned int now) {
+	int i;
+	for(i = train_active_total - 1; i >= 0; i--) {
+		int train = train_active[i];
+		if(trainStep(train, now)) {
+			train_states[train].state = TRAIN_STATE_IDLE;
+			train_active[i] = train_active[--train_active_total];
+		}
+	}
+}
+
+int trainActive() {
+	return train_active_total;
+}
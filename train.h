@@ -0,0 +1,76 @@
+/*
+ * train.h - per-train state table, speed profiles and the reverse sequence
+ */
+
+#ifndef __TRAIN_H__
+#define __TRAIN_H__
+
+#define TRAIN_NUMBER_MIN 1
+#define TRAIN_NUMBER_MAX 80
+#define TRAIN_NUMBER_VALID(number) ((number) >= TRAIN_NUMBER_MIN && (number) <= TRAIN_NUMBER_MAX)
+
+/* Speed byte: level, plus the function bit (lights) */
+#define TRAIN_SPEED_MAX 14
+#define TRAIN_SPEED_REVERSE 15
+#define TRAIN_SPEED_LEVEL 0x0f
+#define TRAIN_SPEED_FUNCTION 0x10
+
+#define TRAIN_STATE_IDLE 0	// Running at the target level
+#define TRAIN_STATE_RAMP 1	// Accelerating to the target level
+#define TRAIN_STATE_STOPPING 2	// Speed 0 sent, waiting out the stopping time before reversing
+
+/*
+ * Behavior of a train model, in ticks (1/100 sec). A stop from level n takes
+ * stop_base + stop_per_level * n. Acceleration goes up ramp_levels at a time,
+ * every ramp_ticks; 0 levels sends the target at once.
+ */
+typedef struct TrainProfile {
+	unsigned char number;	// Train this profile is for, 0 for the default
+	unsigned char stop_base;
+	unsigned char stop_per_level;
+	unsigned char ramp_levels;
+	unsigned char ramp_ticks;
+} TrainProfile;
+
+typedef struct TrainState {
+	unsigned char state;	// TRAIN_STATE_*
+	unsigned char sent;	// Last speed byte sent, level and function bit
+	unsigned char target;	// Level the train is heading to
+	unsigned char function;	// TRAIN_SPEED_FUNCTION or 0, for the next bytes
+	unsigned char reversed;	// Reversed an odd number of times since boot
+	unsigned char reverse_pending;	// Send TRAIN_SPEED_REVERSE once stopped
+	unsigned short stop_ticks;	// Stopping time of the current reverse
+	unsigned int due;	// Tick of the next step
+	unsigned int last;	// Tick of the last byte sent
+	const TrainProfile *profile;
+} TrainState;
+
+/*
+ * Send one speed byte to a train
+ * Return: 1 Queued, 0 No room, the step is retried on the next poll
+ */
+typedef int (*TrainSend)(char speed, char train);
+
+extern TrainState train_states[TRAIN_NUMBER_MAX + 1];
+
+void trainBootstrap(TrainSend send);
+
+/*
+ * Set a train's speed byte. Acceleration is ramped by its profile, slowing
+ * down is sent at once; TRAIN_SPEED_REVERSE starts a reverse instead.
+ */
+void trainSpeed(int train, int speed, unsigned int now);
+
+/*
+ * Stop, wait out the stopping time of the model, reverse and re-accelerate
+ * to the previous level. Reversing again while stopping cancels the reverse.
+ */
+void trainReverse(int train, unsigned int now);
+
+// Run the due steps of every train in a sequence, call once per tick
+void trainPoll(unsigned int now);
+
+// Return: number of trains in a sequence (ramping or stopping)
+int trainActive();
+
+#endif // __TRAIN_H__
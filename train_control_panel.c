@@ -1,18 +1,24 @@
 #include <plio.h>
 #include <bwio.h>
 #include <ts7200.h>
-#include <debug.h>
+#include <hal.h>
+#include <trace.h>
+#include <track.h>
+#include <train.h>
+#include <command.h>
+#include <memory.h>
+#include <telemetry.h>
+#include <control.h>
+#include <rule.h>
+#include "train_control_panel.h"
 
 #define FALSE 0x00000000
 #define TRUE 0xffffffff
 
 /* Timer Constants */
-#define TIMER_MIN 0x00000000
-#define TIMER_MAX 0xffffffff
 #define TIMER_CLOCK_BASE 10
-#define TIMER_CLOCK_TICK 20
-#define TIMER_ADJUST_PERIOD 3000
-#define TIMER_ADJUST_TICK 5
+#define DEBUG_TIMER_US_NUMERATOR 1000
+#define DEBUG_TIMER_US_DENOMINATOR 983
 
 /* ASCI Constants */
 #define ASCI_ESC 27
@@ -32,114 +38,93 @@
 #define LINE_RECENT_SENSOR 5
 #define LINE_SWITCH_TABLE 7
 #define LINE_USER_INPUT 14
-#define LINE_DEBUG 25
-#define LINE_BOTTOM 35
+#define LINE_ROUTE 16
+#define LINE_SCRIPT 17
+#define LINE_COM1 18
+#define LINE_RULES 19
+#define LINE_SENSOR_POLLING 20
+#define LINE_BOOT 21
+#define LINE_MEMORY 23
+#define LINE_DEBUG 29
+#define LINE_TRACE LINE_DEBUG
+#define LINE_BOTTOM 39
 
 #define COLUMN_FIRST 1
 #define COLUMN_WIDTH 8
 #define COLUMN_VALUES COLUMN_WIDTH * 2 + 1
 #define COLUMN_ELAPSED_TIME 70
-#define COLUMN_SENSOR_DEBUG 60
+#define COLUMN_PARSE_TIME 60
+#define COLUMN_MEMORY_WIDTH 21
 
 #define HEIGHT_SWITCH_TABLE 6
 #define WIDTH_SWITCH_TABLE 4
+#define WIDTH_MEMORY_TABLE 3
+#define HEIGHT_TRACE 10
 
 /* User Inputs */
 #define USER_INPUT_MAX 50
-#define USER_COMMAND_TOKEN_MAX 10
 #define USER_COMMAND_QUIT 1
 
-/* Train Control */
-#define SYSTEM_START 96
-#define SYSTEM_STOP 97
-
-#define TRAIN_COMMAND_BUFFER_MAX 200
-#define TRAIN_COMMAND_PAUSE_TIMEOUT 25
-#define TRAIN_COMMAND_DEBUG_LINES 15
-#define TRAIN_COMMAND_DELAY 3
-#define TRAIN_REVERSE 15
-#define TRAIN_REVERSE_DELAY 100
-#define TRAIN_FUNCTION_BASE 16
-
-#define SWITCH_STR 33
-#define SWITCH_CUR 34
-#define SWITCH_OFF 32
-#define SWITCH_TOTAL 22
-#define SWITCH_NAMING_BASE 1
-#define SWITCH_NAMING_MAX 18
-#define SWITCH_NAMING_MID_BASE 153
-#define SWITCH_NAMING_MID_MAX 156
-
-#define SENSOR_AUTO_RESET 192
-#define SENSOR_READ_ONE 192
-#define SENSOR_READ_MULTI 128
-#define SENSOR_DECODER_TOTAL 5
+/* Script Ingestion */
+#define SCRIPT_BUFFER_MAX 4096
+#define SCRIPT_COMMANDS_PER_LOOP 4
+#define SCRIPT_QUEUE_SLACK 50
+
+/* Sensors */
 #define SENSOR_RECENT_TOTAL 8
-#define SENSOR_BYTE_EACH 2
-#define SENSOR_BYTE_SIZE 8
-#define SENSOR_BIT_MASK 0x01
-#define SENSOR_REQUEST_DELAY 0
-#define SENSOR_REQUEST_TIMEOUT TRAIN_COMMAND_PAUSE_TIMEOUT
+#define SENSOR_POLLING_TICKS 100	// Refresh of the sensor polling row, in 1/100 sec
+
+/* Boot phases, see printBoot */
+#define BOOT_PHASE_STACK 0
+#define BOOT_PHASE_IO 1
+#define BOOT_PHASE_CORE 2
+#define BOOT_PHASE_SCREEN 3
+#define BOOT_PHASE_READY 4
+#define BOOT_PHASE_TOTAL 5
+
+/* Traffic Recording */
+#define PLIO_RECORD_MAX 4096
+
+/* Headless mode */
+#define TELEMETRY_STATS_TICKS 10
+#define COMMAND_FRAME_TIMEOUT 10	// Ticks without a byte that drop a partial command frame
 
 /* Global Variable Declarations */
 
 // Debug
-unsigned int dbflags = 0;
+PlRecord *plio_record_ring = 0;
 
-// Timer
-unsigned int previous_timer_value = 0;
-unsigned int timer_value_remained = 0;
-unsigned int timer_tick = 0;
+// Mode and input line, see PanelLoop
+PanelLoop panel_loop;
 
 // User Input
 char user_input_buffer[USER_INPUT_MAX] = {'\0'};
-unsigned int user_input_size = 0;
-
-// Train Commands
-typedef struct TrainCommand {
-	char command;
-	int delay;
-	int pause;
-} TrainCommand;
-TrainCommand train_commands_buffer[TRAIN_COMMAND_BUFFER_MAX] = {};
-unsigned int train_commands_save_index = 0;
-unsigned int train_commands_send_index = 0;
-int train_commands_pause_time = 0;
-
-int switch_ids[SWITCH_TOTAL] = {};
-
-// Sensor Data
-char sensor_decoder_data[SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH] = {};
-char sensor_decoder_ids[SENSOR_DECODER_TOTAL] = {};
-unsigned int sensor_decoder_next = 0;
-
+unsigned int command_parse_time = 0;
+
+// Binary command frames on COM2, in place of a typed line
+TelemetryReceiver command_frame;
+unsigned int command_frame_tick = 0;	// Of the last byte received
+unsigned int command_frames_done = 0;
+unsigned int command_frames_rejected = 0;
+
+// Script Ingestion
+char script_buffer[SCRIPT_BUFFER_MAX] = {};
+unsigned int script_save_index = 0;
+unsigned int script_parse_index = 0;
+unsigned int script_lines = 0;
+char script_line[USER_INPUT_MAX] = {'\0'};
+unsigned int script_started_tick = 0;
+unsigned int script_accepted = 0;
+unsigned int script_invalid = 0;
+unsigned int script_dropped = 0;
+unsigned int script_line_dropped = 0;	// 1 while the rest of a line too long for script_line is dropped
+
+// Recent Sensors
 unsigned int sensor_recent_next = 0;
-unsigned int sensor_request_cts = 0;
-int sensor_request_time = 0;
-
-/*
- * Hardware Register Manipulation
- */
-
-int getRegister(int base, int offset) {
-	int *addr = (int *)(base + offset);
-	return *addr;
-}
 
-int getRegisterBit(int base, int offset, int mask) {
-	return (getRegister(base, offset)) & mask;
-}
-
-void setRegister(int base, int offset, int value) {
-	int *addr = (int *)(base + offset);
-	*addr = value;
-}
-
-void setRegisterBit(int base, int offset, int mask, int value) {
-	int buf = getRegister(base, offset);
-	buf = value ? buf | mask : buf & ~mask;
-	setRegister(base, offset, buf);
-}
+// Boot: debug timer at the start of main, and each phase in us, READY from that start to the end of the first pass
+unsigned int boot_started = 0;
+unsigned int boot_phases[BOOT_PHASE_TOTAL] = {};
 
 /* 
  * IO Control
@@ -157,362 +142,575 @@ inline void moveCursorTo(int line, int column) {
 }
 
 inline void moveToUserInput() {
-	moveCursorTo(LINE_USER_INPUT, COLUMN_VALUES + user_input_size);
+	moveCursorTo(LINE_USER_INPUT, COLUMN_VALUES + panel_loop.user_input_echoed);
 }
 
-inline void printLineDivider() {
-	plprintf(COM2, "--------------------------------------------------------------------------------\n");
+/*
+ * Draw on the user input line through the interactive lane of COM2, ahead
+ * of the screen updates queued, then restore the cursor for them. The bulk
+ * lane moves the cursor back to the input once it has caught up.
+ */
+inline void startInteractive() {
+	plsetlane(COM2, PLLANE_INTERACTIVE);
+	printAsciControl(COM2, ASCI_CURSOR_SAVE, NO_ARG, NO_ARG);
+}
+
+inline void endInteractive() {
+	printAsciControl(COM2, ASCI_CURSOR_RETURN, NO_ARG, NO_ARG);
+	plsetlane(COM2, PLLANE_BULK);
+	moveToUserInput();
+}
+
+/*
+ * Echo what changed on the input line since the last echo, once the
+ * interactive lane is empty, so that a pasted line is one message rather
+ * than one per char.
+ */
+void echoUserInput() {
+	if(panel_loop.headless) return;
+	if(panel_loop.user_input_echoed == panel_loop.user_input_size && !panel_loop.user_input_clear) return;
+	if(plchpending(plchannel(COM2), PLLANE_INTERACTIVE) > 0) return;
+	
+	startInteractive();
+	moveToUserInput();
+	plputstr(COM2, user_input_buffer + panel_loop.user_input_echoed);
+	if(panel_loop.user_input_clear) printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	panel_loop.user_input_echoed = panel_loop.user_input_size;
+	panel_loop.user_input_clear = FALSE;
+	endInteractive();
 }
 
+#define SCREEN_DIVIDER "--------------------------------------------------------------------------------\n"
+
+/*
+ * The empty screen, prebuilt rather than printed piece by piece: clear,
+ * home, then one row per LINE_*, and the switch table in the order of
+ * switch_ids (columns of HEIGHT_SWITCH_TABLE). Keep it in step with them.
+ */
+static const char panel_screen[] =
+	"\033[" ASCI_CLEAR_SCREEN "\033[1;1" ASCI_CURSOR_TO
+	"Märklin Digital Train Control Panel                  Time elapsed: \n"
+	SCREEN_DIVIDER
+	"Last Command  | \n"
+	SCREEN_DIVIDER
+	"Recent Sensor | \n"
+	SCREEN_DIVIDER
+	"Track Switchs | 1     | ?     | 7     | ?     | 13    | ?     | 153   | ?     | \n"
+	"              | 2     | ?     | 8     | ?     | 14    | ?     | 154   | ?     | \n"
+	"              | 3     | ?     | 9     | ?     | 15    | ?     | 155   | ?     | \n"
+	"              | 4     | ?     | 10    | ?     | 16    | ?     | 156   | ?     | \n"
+	"              | 5     | ?     | 11    | ?     | 17    | ?     | \n"
+	"              | 6     | ?     | 12    | ?     | 18    | ?     | \n"
+	SCREEN_DIVIDER
+	"Command       | \n"
+	SCREEN_DIVIDER
+	"Route         | \n"
+	"Script        | \n"
+	"COM1          | \n"
+	"Rules         | \n"
+	"Sensors       | \n"
+	"Boot          | \n"
+	SCREEN_DIVIDER
+	"Memory        | \n";
+
+// One block into the bulk lane of COM2
 void initializeScreen() {
-	int i;
+	plputblock(COM2, panel_screen, sizeof(panel_screen) - 1);
+}
+
+void printSwitchState(int index) {
+	if(panel_loop.headless) {
+		telemetrySwitch(switch_ids[index], switch_states[index]);
+		return;
+	}
+	int line = index % HEIGHT_SWITCH_TABLE + LINE_SWITCH_TABLE;
+	int column = (index / HEIGHT_SWITCH_TABLE) * COLUMN_WIDTH * 2 + COLUMN_VALUES + COLUMN_WIDTH;
+	moveCursorTo(line, column);
+	plputc(COM2, switch_states[index]);
+}
+
+void printSensorName(int sensor) {
+	plprintf(COM2, "%c%d", 'A' + sensor / TRACK_DECODER_SENSORS, sensor % TRACK_DECODER_SENSORS + 1);
+}
+
+void printRoute(const ControlRoute *route) {
+	if(panel_loop.headless) return;
+	moveCursorTo(LINE_ROUTE, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	printSensorName(route->from);
+	plputstr(COM2, " -> ");
+	printSensorName(route->to);
+	plprintf(COM2, ": %d switches thrown", route->switches);
+	if(route->done) {
+		plprintf(COM2, " in %d.", route->ticks / 100);
+		if(route->ticks % 100 < 10) plputc(COM2, '0');
+		plprintf(COM2, "%ds", route->ticks % 100);
+	}
+	if(TRACK_LAYOUT_PLACEHOLDER) plputstr(COM2, " | placeholder track");
+	moveToUserInput();
+}
+
+void printCom1Status() {
+	ControlStats stats;
+	if(panel_loop.headless) return; // In the stats frames
+	controlStats(&stats);
+	moveCursorTo(LINE_COM1, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	plprintf(COM2, "%s | %u urgent | %u stalls, longest %ums | %u dropped in %u rejected", stats.stalled ? "CTS stalled" : "Running", stats.urgent, stats.stalls, stats.stall_max / 2, stats.dropped, stats.rejected);
+	moveToUserInput();
+}
+
+void printRules() {
+	ControlStats stats;
+	if(panel_loop.headless) return;
+	controlStats(&stats);
+	moveCursorTo(LINE_RULES, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	plprintf(COM2, "%u rules | %u fired, %u dropped | latency %uus, max %uus, mean %uus", stats.rules, stats.rules_fired, stats.rules_dropped, stats.rule_latency_last, stats.rule_latency_max, stats.rule_latency_mean);
+	moveToUserInput();
+}
+
+// Window and rate of the sensor polling, sweeps over the last refresh
+void printSensorPolling() {
+	static unsigned int sweeps_previous = 0, tick_previous = 0;
+	ControlStats stats;
+	if(panel_loop.headless) return;
+	controlStats(&stats);
+	unsigned int ticks = stats.tick - tick_previous;
+	unsigned int rate = ticks > 0 ? (stats.sensor_sweeps - sweeps_previous) * 100 / ticks : 0;
+	sweeps_previous = stats.sensor_sweeps;
+	tick_previous = stats.tick;
+	moveCursorTo(LINE_SENSOR_POLLING, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	plprintf(COM2, "window %u, %u in flight | %u sweeps/s | %u timeouts, %u stray", stats.sensor_window, stats.sensor_outstanding, rate, stats.sensor_timeouts, stats.sensor_stray);
+	moveToUserInput();
+}
+
+// Time of each boot phase, and from the start of main to the end of the first pass
+void printBoot() {
+	ControlStats stats;
+	if(panel_loop.headless) return;
+	controlStats(&stats);
+	moveCursorTo(LINE_BOOT, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	plprintf(COM2, "stack %uus | io %uus | core %uus, %u stale | screen %uus | ready in %uus", boot_phases[BOOT_PHASE_STACK], boot_phases[BOOT_PHASE_IO], boot_phases[BOOT_PHASE_CORE], stats.sensor_drained, boot_phases[BOOT_PHASE_SCREEN], boot_phases[BOOT_PHASE_READY]);
+	moveToUserInput();
+}
+
+// Stack high watermark, image sections and the size of each buffer, '*' if on the stack
+void printMemory() {
+	MemoryUsage usage;
+	const MemoryRegion *regions;
+	int i, total = memoryRegions(&regions);
+	if(panel_loop.headless) return;
 	
-	printAsciControl(COM2, ASCI_CLEAR_SCREEN, NO_ARG, NO_ARG);
-	moveCursorTo(LINE_ELAPSED_TIME, COLUMN_FIRST);
-	plprintf(COM2, "Märklin Digital Train Control Panel                  Time elapsed: \n");
-	printLineDivider();
-	plprintf(COM2, "Last Command  | \n");
-	printLineDivider();
-	plprintf(COM2, "Recent Sensor | \n");
-	printLineDivider();
-	plprintf(COM2, "Track Switchs | ");
-	for(i = 0; i < SWITCH_TOTAL; i++) {
-		switch_ids[i] = i < SWITCH_NAMING_MAX ? i + SWITCH_NAMING_BASE : i + SWITCH_NAMING_MID_BASE - SWITCH_NAMING_MAX;
+	memoryUsage(&usage);
+	moveCursorTo(LINE_MEMORY, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	plprintf(COM2, "Stack %u max, %u now of %u | text %u data %u bss %u", usage.stack_used, usage.stack_now, usage.stack_painted, usage.text, usage.data, usage.bss);
+	for(i = 0; i < total; i++) {
+		if(i % WIDTH_MEMORY_TABLE == 0) {
+			moveCursorTo(LINE_MEMORY + 1 + i / WIDTH_MEMORY_TABLE, COLUMN_FIRST);
+			printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+			plputstr(COM2, "              | ");
+		}
+		moveCursorTo(LINE_MEMORY + 1 + i / WIDTH_MEMORY_TABLE, COLUMN_VALUES + (i % WIDTH_MEMORY_TABLE) * COLUMN_MEMORY_WIDTH);
+		plprintf(COM2, "%s %u%c", regions[i].name, regions[i].size, memoryIsStatic(regions[i].address) ? ' ' : '*');
 	}
-	int cells = (WIDTH_SWITCH_TABLE * HEIGHT_SWITCH_TABLE - 1);
-	for(i = 0; i < cells; i++) {
-		int index = (i % WIDTH_SWITCH_TABLE) * HEIGHT_SWITCH_TABLE + i / WIDTH_SWITCH_TABLE;
-		if(index < SWITCH_TOTAL) {
-			int id = switch_ids[index];
-			plprintf(COM2, "%d   ", id);
-			if(id / 100 == 0) plputc(COM2, ' ');
-			if(id / 10 == 0) plputc(COM2, ' ');
-			plputstr(COM2, "| ?     | ");
+	moveToUserInput();
+}
+
+// Latest trace records, newest first
+void printTrace() {
+	int i;
+	if(panel_loop.headless) return;
+	for(i = 0; i < HEIGHT_TRACE; i++) {
+		const TraceRecord *record = traceRecent(i);
+		moveCursorTo(LINE_TRACE + i, COLUMN_FIRST);
+		printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+		if(record == 0) {
+			if(i == 0) plputstr(COM2, TRACE_ENABLED ? "Trace is empty" : "Trace is compiled out, build with make TRACE=1");
+			continue;
 		}
-		if(i % WIDTH_SWITCH_TABLE == (WIDTH_SWITCH_TABLE - 1)) plprintf(COM2, "\n              | ");
+		plprintf(COM2, "%u ", record->time);
+		plprintf(COM2, (char *)traceFormat(record->event), record->a, record->b);
 	}
-	plputc(COM2, '\n');
-	printLineDivider();
-	plprintf(COM2, "Command       | \n");
+	moveToUserInput();
 }
 
-/* 
- * Timer Control
+void printElapsedTime() {
+	if(panel_loop.headless) return; // In the stats frames
+	moveCursorTo(LINE_ELAPSED_TIME, COLUMN_ELAPSED_TIME);
+	plprintf(COM2, "%d:%d.%d", (control_loop.tick / TIMER_CLOCK_BASE) / 600, ((control_loop.tick / TIMER_CLOCK_BASE) % 600) / 10, (control_loop.tick / TIMER_CLOCK_BASE) % 10);
+	moveToUserInput();
+}
+
+/*
+ * User Interactions
  */
 
-unsigned int setTimerControl(int timer_base, unsigned int enable, unsigned int mode, unsigned int clksel) {
-	unsigned int* timer_control_addr = (unsigned int*) (timer_base + CRTL_OFFSET);
-	// DEBUG(DB_TIMER, "Timer3 base: 0x%x ctrl addr: 0x%x offset: 0x%x.\n", timer_base, timer_control_addr, CRTL_OFFSET);
+void startScript();
+void stopScript();
+void startHeadless();
+void stopHeadless();
+
+// The commands of the panel, the others go to the control core. Return: COMMAND_RESULT_*
+int executeCommand(const CommandRecord *record) {
+	unsigned int first, count;
+	switch(record->opcode) {
+		case COMMAND_QUIT:
+			return COMMAND_RESULT_QUIT;
+		case COMMAND_SCRIPT:
+			if(panel_loop.script_mode == FALSE) startScript();
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_END:
+			if(panel_loop.script_mode == FALSE) return COMMAND_RESULT_INVALID;
+			stopScript();
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_RECORD:
+			plrecord(plio_record_ring, PLIO_RECORD_MAX);
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_MEMORY:
+			printMemory();
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_TRACE:
+			printTrace();
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_HEADLESS:
+			if(panel_loop.headless == FALSE) startHeadless();
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_UI:
+			if(panel_loop.headless == FALSE) return COMMAND_RESULT_INVALID;
+			stopHeadless();
+			return COMMAND_RESULT_SYSTEM;
+		case COMMAND_REPLAY:
+			// Feed the recorded input back through the control logic
+			if(plreplaying()) return COMMAND_RESULT_INVALID;
+			plrecorded(&first, &count);
+			if(plreplay(plio_record_ring, PLIO_RECORD_MAX, first, count) < 0) return COMMAND_RESULT_INVALID;
+			return COMMAND_RESULT_SYSTEM;
+		default:
+			return controlSubmit(record);
+	}
+}
 
-	unsigned int control_value = (ENABLE_MASK & enable) | (MODE_MASK & mode) | (CLKSEL_MASK & clksel) ;
-	// DEBUG(DB_TIMER, "Timer3 control changing from 0x%x to 0x%x.\n", *timer_control_addr, control_value);
+// Return: COMMAND_RESULT_*
+int handleUserCommand(const char *input) {
+	CommandRecord record[COMMAND_PARSED_MAX];
+	
+	unsigned int parse_start = getDebugTimerValue();
+	int parsed = commandParse(input, record);
+	command_parse_time = getDebugTimerValue() - parse_start;
+	
+	if(parsed < 0) {
+		TRACE(TRACE_USER_INVALID, command_parse_time, 0);
+		return COMMAND_RESULT_INVALID;
+	}
+	TRACE(TRACE_USER_COMMAND, record[0].opcode, record[0].count);
+	return executeCommand(record);
+}
 
-	*timer_control_addr = control_value;
-	return *timer_control_addr;
+void printLastCommand(int command_result, char *input) {
+	if(panel_loop.headless) {
+		telemetryAck(command_result, command_parse_time * DEBUG_TIMER_US_NUMERATOR / DEBUG_TIMER_US_DENOMINATOR);
+		return;
+	}
+	moveCursorTo(LINE_LAST_COMMAND, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	if(command_result > 0) plputstr(COM2, input);
+	else plprintf(COM2, command_result == COMMAND_RESULT_BUSY ? "Queue Full: %s" : "Invalid Command: %s", input);
+	moveCursorTo(LINE_LAST_COMMAND, COLUMN_PARSE_TIME);
+	plprintf(COM2, "Parsed in %uus", command_parse_time * DEBUG_TIMER_US_NUMERATOR / DEBUG_TIMER_US_DENOMINATOR);
+}
+
+void printCommandFrame(unsigned int done, int total, unsigned int status, unsigned int decode_us) {
+	if(panel_loop.headless) return; // In the frame acknowledgement
+	moveCursorTo(LINE_LAST_COMMAND, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	plprintf(COM2, "Frame %u: %u of %d operations done, status %u | %u done, %u rejected", command_frame.sequence, done, total, status, command_frames_done, command_frames_rejected);
+	moveCursorTo(LINE_LAST_COMMAND, COLUMN_PARSE_TIME);
+	plprintf(COM2, "Decoded in %uus", decode_us);
+	moveToUserInput();
 }
 
-unsigned int getTimerValue(int timer_base) {
-	unsigned int* timer_value_addr = (unsigned int*) (timer_base + VAL_OFFSET);
-	unsigned int value = *timer_value_addr;
-	return value;
+/*
+ * Whether executeCommand would run an operation of a frame, headless being
+ * the mode the operations before it leave the panel in
+ */
+static int checkFrameOperation(const CommandRecord *record, int *headless) {
+	switch(record->opcode) {
+		case COMMAND_QUIT:
+		case COMMAND_MEMORY:
+		case COMMAND_TRACE:
+			return 1;
+		case COMMAND_HEADLESS:
+			*headless = TRUE;
+			return 1;
+		case COMMAND_UI:
+			if(*headless == FALSE) return 0;
+			*headless = FALSE;
+			return 1;
+		default:
+			return controlCheck(record);
+	}
 }
 
-unsigned int handleTimeElapse() {
-	unsigned int timer_value = getTimerValue(TIMER3_BASE);
-	unsigned int time_elapsed = previous_timer_value - timer_value;
+/*
+ * Run the operations of a complete command frame, all of them or none:
+ * every operation is checked before the first runs, a q only as the last
+ * one, and the queue must have room for them all. Then acknowledge.
+ * Return: USER_COMMAND_QUIT if an operation was q, 0 otherwise
+ */
+int handleCommandFrame(int received) {
+	CommandRecord records[COMMAND_OPERANDS_MAX];
+	int i, total = 0, result = COMMAND_RESULT_SYSTEM, headless = panel_loop.headless;
+	unsigned int done = 0, cost = 0, status = TELEMETRY_STATUS_DONE;
 	
-	// Fix time_elapsed when underflow
-	if(timer_value > previous_timer_value) {
-		time_elapsed = previous_timer_value + (TIMER_MAX - timer_value) + 1;
+	unsigned int decode_start = getDebugTimerValue();
+	if(received < 0) status = TELEMETRY_STATUS_CHECKSUM;
+	else if(command_frame.type != TELEMETRY_COMMANDS) status = TELEMETRY_STATUS_INVALID;
+	else if((total = commandDecode(command_frame.payload, command_frame.size, records, COMMAND_OPERANDS_MAX)) < 0) status = TELEMETRY_STATUS_INVALID;
+	for(i = 0; status == TELEMETRY_STATUS_DONE && i < total; i++) {
+		if(!checkFrameOperation(&records[i], &headless) || (records[i].opcode == COMMAND_QUIT && i < total - 1)) status = TELEMETRY_STATUS_FAILED;
+		cost += controlQueueCost(&records[i]);
 	}
+	if(status == TELEMETRY_STATUS_DONE && cost > trainCommandsFree()) status = TELEMETRY_STATUS_BUSY;
+	unsigned int decode_us = (getDebugTimerValue() - decode_start) * DEBUG_TIMER_US_NUMERATOR / DEBUG_TIMER_US_DENOMINATOR;
 	
-	// If time elapsed more than 1/100 sec
-	if(time_elapsed >= TIMER_CLOCK_TICK)
-	{
-		// Add elapsed time into remaining ticks, then convert to 1/100 sec
-		timer_value_remained += time_elapsed;
-		unsigned int tick_elapsed = timer_value_remained / TIMER_CLOCK_TICK;
-		timer_value_remained %= TIMER_CLOCK_TICK;
-		timer_tick += tick_elapsed;
-		previous_timer_value = timer_value;
-		
-		// if(timer_tick % TIMER_ADJUST_PERIOD == 0) timer_tick += TIMER_ADJUST_TICK;
-		
-		moveCursorTo(LINE_ELAPSED_TIME, COLUMN_ELAPSED_TIME);
-		plprintf(COM2, "%d:%d.%d", (timer_tick / TIMER_CLOCK_BASE) / 600, ((timer_tick / TIMER_CLOCK_BASE) % 600) / 10, (timer_tick / TIMER_CLOCK_BASE) % 10);
-		moveToUserInput();
-		
-		return tick_elapsed;
+	for(i = 0; status == TELEMETRY_STATUS_DONE && i < total; i++) {
+		result = executeCommand(&records[i]);
+		if(result == COMMAND_RESULT_INVALID) status = TELEMETRY_STATUS_FAILED;
+		else if(result == COMMAND_RESULT_BUSY) status = TELEMETRY_STATUS_BUSY;
+		else done++;
+		if(result == COMMAND_RESULT_QUIT) break;
 	}
 	
-	return 0;
+	TRACE(TRACE_USER_FRAME, command_frame.sequence, status);
+	status == TELEMETRY_STATUS_DONE ? command_frames_done++ : command_frames_rejected++;
+	telemetryFrameAck(command_frame.sequence, done, status, decode_us);
+	printCommandFrame(done, total, status, decode_us);
+	return result == COMMAND_RESULT_QUIT ? USER_COMMAND_QUIT : 0;
 }
 
 /*
- * Train Control
+ * Script Ingestion
  */
-int pushTrainCommand(char command, int delay, int pause) {
-	unsigned int next_index = (train_commands_save_index + 1) % TRAIN_COMMAND_BUFFER_MAX;
-	if(next_index != train_commands_send_index) {
-		train_commands_buffer[train_commands_save_index].command = command;
-		train_commands_buffer[train_commands_save_index].delay = delay;
-		train_commands_buffer[train_commands_save_index].pause = pause;
-		
-		int sending_delay = train_commands_buffer[train_commands_send_index].delay;
-		if(sending_delay > TRAIN_COMMAND_DELAY || command < SENSOR_READ_ONE || command > (SENSOR_READ_ONE + SENSOR_DECODER_TOTAL)) {
-			// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG + (train_commands_save_index % TRAIN_COMMAND_DEBUG_LINES) + 1, COLUMN_FIRST, "%d <- %d %d %d", train_commands_save_index, command, delay, pause);
-			// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG + (next_index % TRAIN_COMMAND_DEBUG_LINES) + 1, COLUMN_FIRST, "%c[%s", ASCI_ESC, ASCI_CLEAR_LINE);
-		}
-		
-		train_commands_save_index = next_index;
-		
-		return 1;
-	}
-	
-	// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG - 1, COLUMN_FIRST, "Command buffer full\n");
-	return 0;
+
+void printScriptStatus() {
+	unsigned int ticks = control_loop.tick - script_started_tick;
+	if(panel_loop.headless) return;
+	moveCursorTo(LINE_SCRIPT, COLUMN_VALUES);
+	printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+	plprintf(COM2, "%s %u accepted, %u invalid, %u dropped, %u cmd/s", panel_loop.script_mode ? "Running" : "Ended", script_accepted, script_invalid, script_dropped, ticks > 0 ? script_accepted * 100 / ticks : 0);
+	moveToUserInput();
 }
 
-int popTrainCommand(unsigned int tick_elapsed) {
-	if(train_commands_pause_time > 0) {
-		if(tick_elapsed > 0) {
-			train_commands_pause_time -= tick_elapsed;
-		}
-		else return -1;
-		
-		if(train_commands_pause_time <= 0) {
-			// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG - 1, COLUMN_FIRST, "Override %d\n", train_commands_pause_time);
-		}
-	}
+void startScript() {
+	panel_loop.script_mode = TRUE;
+	script_save_index = 0;
+	script_parse_index = 0;
+	script_lines = 0;
+	script_started_tick = control_loop.tick;
+	script_accepted = 0;
+	script_invalid = 0;
+	script_dropped = 0;
+	script_line_dropped = 0;
 	
-	if(train_commands_send_index != train_commands_save_index) {
-		int delay = train_commands_buffer[train_commands_send_index].delay;
-		if(delay > 0 && tick_elapsed > 0) {
-			delay -= tick_elapsed;
-			train_commands_buffer[train_commands_send_index].delay = delay;
-			// // DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG + (train_commands_send_index % TRAIN_COMMAND_DEBUG_LINES) + 1, COLUMN_FIRST + 20, "-| D:%d", delay);
-		}
-		
-		if(delay <= 0) {
-			unsigned int next_index = (train_commands_send_index + 1) % TRAIN_COMMAND_BUFFER_MAX;
-			train_commands_pause_time = train_commands_buffer[train_commands_send_index].pause;
-			if(train_commands_pause_time > 0) {
-				// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG - 1, COLUMN_FIRST, "Paused    \n");
-			}
-			
-			char command = train_commands_buffer[train_commands_send_index].command;
-			if(command < SENSOR_READ_ONE || command > (SENSOR_READ_ONE + SENSOR_DECODER_TOTAL)) {
-				// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG + (train_commands_send_index % TRAIN_COMMAND_DEBUG_LINES) + 1, COLUMN_FIRST + 20, "-> %d %d %d", command, delay, train_commands_pause_time);
-			}
-			plputc(COM1, command);
-			
-			train_commands_send_index = next_index;
-			
-			return 1;
+	// Let the UART hold the bytes arrived while the loop is busy
+	plsetfifo(COM2, ON);
+	printScriptStatus();
+}
+
+void stopScript() {
+	panel_loop.script_mode = FALSE;
+	plsetfifo(COM2, panel_loop.headless ? ON : OFF);
+	printScriptStatus();
+}
+
+// Move every received char into the script buffer, without echo
+void receiveScript() {
+	char c;
+	while(plgetc(COM2, &c) > 0) {
+		unsigned int next_index = (script_save_index + 1) % SCRIPT_BUFFER_MAX;
+		if(next_index == script_parse_index) {
+			script_dropped++;
+			continue;
 		}
+		script_buffer[script_save_index] = c;
+		script_save_index = next_index;
+		if(c == '\n' || c == '\r') script_lines++;
 	}
-	
-	return 0;
 }
 
 /*
- * User Interactions
+ * Copy the next line (with its EOL) into script_line. A line with no EOL
+ * within USER_INPUT_MAX - 1 chars is counted as invalid and dropped whole,
+ * up to its EOL, which may not have arrived yet: none of it runs.
+ * Return: size of the line, 0 if no complete line
  */
-
-// export the first token to 'token' and return the address of the start of next token (maybe EOL)
-const char *str2token(const char *str, char *token, int token_size) {
-	token_size--;
-	char *start = token;
-	while(*str != '\0' && *str != ' ' && *str != '\n' && *str != '\r' && (token - start) < token_size) *token++ = *str++;
-	*token = '\0';
-	while(*str == ' ') str++;
-	return str;
-}
-
-int strcmp(const char *src, const char *dst) {
-	int ret = 0;
-	while( ! (ret = *(unsigned char *)src - *(unsigned char *)dst) && *dst) ++src, ++dst;
-	if ( ret < 0 ) ret = -1 ;
-	else if ( ret > 0 ) ret = 1 ;
-	return( ret );
-}
-
-int atoi(const char *str, int base) {
-	int sign = 1, n = 0;
-	while(*str == ' ') str++;
-	sign = 1;
-	switch(*str) {
-		case '-': sign = -1;
-		default: 
-			break;
-	}
-	while((*str) >= '0' && (*str) <= '9') n = base * n + (*str++ - '0');
-	return (sign * n);
-}
-
-// Return: -1 Invalid command; 1 System command; 2 Normal command
-int handleUserCommand() {
-	// Single char command
-	if(user_input_size == 2) {
-		switch(user_input_buffer[0]) {
-			case 'g':
-				// DEBUG(DB_TRAIN_CTRL, "Starting\n");
-				pushTrainCommand(SYSTEM_START, TRAIN_COMMAND_DELAY, FALSE);
-				break;
-			case 's':
-				// DEBUG(DB_TRAIN_CTRL, "Stoping\n");
-				pushTrainCommand(SYSTEM_STOP, TRAIN_COMMAND_DELAY, FALSE);
-				break;
-			default:
-				break;
+unsigned int popScriptLine() {
+	while(script_line_dropped && script_parse_index != script_save_index) {
+		char c = script_buffer[script_parse_index];
+		script_parse_index = (script_parse_index + 1) % SCRIPT_BUFFER_MAX;
+		if(c == '\n' || c == '\r') {
+			script_lines--;
+			script_line_dropped = 0;
 		}
-		return 1;
 	}
+	if(script_line_dropped) return 0;
 	
-	const char *str = user_input_buffer;
-	char command[USER_COMMAND_TOKEN_MAX], token[USER_COMMAND_TOKEN_MAX];
-	command[0] = '\0';
-	token[0] = '\0';
-	str = str2token(str, command, USER_COMMAND_TOKEN_MAX);
-	// DEBUG_JMP(DB_USER_INPUT, LINE_DEBUG + 1, COLUMN_FIRST, "User Input: Extracted command %s from 0x%x to 0x%x\n", command, user_input_buffer, str);
+	unsigned int pending = (script_save_index + SCRIPT_BUFFER_MAX - script_parse_index) % SCRIPT_BUFFER_MAX;
+	if(script_lines == 0 && pending < USER_INPUT_MAX - 1) return 0;
 	
-	if(strcmp(command, "tr") == 0 || strcmp(command, "rv") == 0 || strcmp(command, "sw") == 0) {
-		str = str2token(str, token, USER_COMMAND_TOKEN_MAX);
-		if(token[0] == '\0') return -1;
-		unsigned char number = atoi(token, 10);
-		
-		// DEBUG_JMP(DB_USER_INPUT, LINE_DEBUG + 2, COLUMN_FIRST, "User Input: Arg1 0x%x\n", number);
-		str = str2token(str, token, USER_COMMAND_TOKEN_MAX);
-		unsigned char value = 0;
-		int line = 0, column = 0, index = 0;
-		switch(command[0]) {
-			case 'r':
-			case 't':
-				if(command[0] == 't' && token[0] == '\0') return -1;
-				value = (command[0] == 'r') ? TRAIN_REVERSE : atoi(token, 10);
-				// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG, COLUMN_FIRST, "#%u Speed %u\n", number, value);
-				break;
-			case 's':
-				if(token[0] != 'S' && token[0] != 'C') return -1;
-				if(number < SWITCH_NAMING_BASE || (number > SWITCH_NAMING_MAX && number < SWITCH_NAMING_MID_BASE) || number > SWITCH_NAMING_MID_MAX) return -1;
-				value = (token[0] == 'S') ? SWITCH_STR : SWITCH_CUR;
-				// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG, COLUMN_FIRST, "#%d Direct %s\n", number, token);
-				index = number > SWITCH_NAMING_MAX ? number - SWITCH_NAMING_MID_BASE + SWITCH_NAMING_MAX : number - SWITCH_NAMING_BASE;
-				line = index % HEIGHT_SWITCH_TABLE + LINE_SWITCH_TABLE;
-				column = (index / HEIGHT_SWITCH_TABLE) * COLUMN_WIDTH * 2 + COLUMN_VALUES + COLUMN_WIDTH;
-				// DEBUG_JMP(DB_IO, LINE_DEBUG, COLUMN_FIRST, "Cursor to %d, %d", line, column);
-				moveCursorTo(line, column);
-				plputc(COM2, token[0]);
-				break;
-			default:
-				return -1;
+	unsigned int size = 0;
+	while(script_parse_index != script_save_index && size < USER_INPUT_MAX - 1) {
+		char c = script_buffer[script_parse_index];
+		script_parse_index = (script_parse_index + 1) % SCRIPT_BUFFER_MAX;
+		script_line[size++] = c;
+		if(c == '\n' || c == '\r') {
+			script_lines--;
+			script_line[size] = '\0';
+			return size;
 		}
-		pushTrainCommand(value, TRAIN_COMMAND_DELAY, FALSE);
-		pushTrainCommand(number, FALSE, FALSE);
-		if(value == TRAIN_REVERSE || value == (TRAIN_REVERSE + TRAIN_FUNCTION_BASE)) {
-			pushTrainCommand(25, TRAIN_REVERSE_DELAY, FALSE);
-			pushTrainCommand(number, FALSE, FALSE);
-		}
-		pushTrainCommand(SWITCH_OFF, TRAIN_COMMAND_DELAY, FALSE); // Turn off the solenoid
+	}
+	
+	// Too long: drop it, the rest of it on the next calls
+	script_line_dropped = 1;
+	script_invalid++;
+	return 0;
+}
+
+int handleScript() {
+	receiveScript();
+	
+	// Only take commands while the train command buffer has room for them
+	int i, command_result = 0, handled = 0;
+	unsigned int invalid = script_invalid;
+	for(i = 0; i < SCRIPT_COMMANDS_PER_LOOP && trainCommandsFree() >= SCRIPT_QUEUE_SLACK; i++) {
+		unsigned int size = popScriptLine();
+		if(size == 0) break;
+		if(size == 1) continue; // Empty line, or the second half of CRLF
 		
-		return 2;
+		command_result = handleUserCommand(script_line);
+		if(command_result == COMMAND_RESULT_QUIT) return USER_COMMAND_QUIT;
+		command_result > 0 ? script_accepted++ : script_invalid++;
+		handled++;
+		if(panel_loop.script_mode == FALSE) break;
 	}
 	
-	return -1;
+	if(handled > 0) printLastCommand(command_result, script_line);
+	if(handled > 0 || script_invalid != invalid) printScriptStatus();
+	return 0;
 }
 
 int handleUserInput() {
+	if(panel_loop.script_mode) return handleScript();
+	
 	char user_input_char = '\0';
+	if(command_frame.received > 0 && control_loop.tick - command_frame_tick > COMMAND_FRAME_TIMEOUT) {
+		command_frame.received = 0;
+		command_frames_rejected++;
+		telemetryFrameAck(command_frame.sequence, 0, TELEMETRY_STATUS_TIMEOUT, 0);
+	}
 	if(plgetc(COM2, &user_input_char) > 0) {
 		
-		// Push or pop char from user_input_buffer
-		if(user_input_char == ASCI_BACKSPACE && user_input_size > 0){
-			user_input_size--;
-			user_input_buffer[user_input_size] = '\0';
-			moveToUserInput();
-			printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+		// Binary command frame, its start byte cannot be typed
+		if(command_frame.received > 0 || (unsigned char)user_input_char == TELEMETRY_START) {
+			int received = telemetryReceive(&command_frame, user_input_char);
+			command_frame_tick = control_loop.tick;
+			return received != 0 ? handleCommandFrame(received) : 0;
 		}
-		else if(user_input_char != ASCI_BACKSPACE && user_input_size < (USER_INPUT_MAX - 1)) {
-			moveToUserInput();
-			user_input_buffer[user_input_size] = user_input_char;
-			user_input_size++;
-			user_input_buffer[user_input_size] = '\0';
-			// moveToUserInput();
-			plputc(COM2, user_input_char);
+		
+		// Push or pop char from user_input_buffer, echoUserInput() draws it
+		if(user_input_char == ASCI_BACKSPACE && panel_loop.user_input_size > 0){
+			panel_loop.user_input_size--;
+			user_input_buffer[panel_loop.user_input_size] = '\0';
+			if(panel_loop.user_input_echoed > panel_loop.user_input_size) {
+				panel_loop.user_input_echoed = panel_loop.user_input_size;
+				panel_loop.user_input_clear = TRUE;
+			}
+		}
+		else if(user_input_char != ASCI_BACKSPACE && panel_loop.user_input_size < (USER_INPUT_MAX - 1)) {
+			user_input_buffer[panel_loop.user_input_size] = user_input_char;
+			panel_loop.user_input_size++;
+			user_input_buffer[panel_loop.user_input_size] = '\0';
 		}
 		else if(user_input_char != '\n' && user_input_char != '\r'){
 			return -1;
 		}
 		
 		// If is EOL or buffer full
-		if(user_input_char == '\n' || user_input_char == '\r' || user_input_size >= USER_INPUT_MAX) {
-			// DEBUG_JMP(DB_USER_INPUT, LINE_DEBUG, COLUMN_FIRST, "User Input: Reach EOL. Input Size %u, value %s\n", user_input_size, user_input_buffer);
+		if(user_input_char == '\n' || user_input_char == '\r' || panel_loop.user_input_size >= USER_INPUT_MAX) {
+			int command_result = handleUserCommand(user_input_buffer);
 			
 			// If is q, quit
-			if(user_input_size == 2 && user_input_buffer[0] == 'q') {
+			if(command_result == COMMAND_RESULT_QUIT) {
 				return USER_COMMAND_QUIT;
 			}
 			
-			int command_result = handleUserCommand();
-			
 			// Send to last command
-			moveCursorTo(LINE_LAST_COMMAND, COLUMN_VALUES);
-			printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
-			(command_result > 0 ? plputstr(COM2, user_input_buffer) : plprintf(COM2, "Invalid Command: %s", user_input_buffer));
+			printLastCommand(command_result, user_input_buffer);
 			
-			// Reset input buffer
+			// Reset input buffer, clearing the line ahead of the echo of the next one
 			user_input_buffer[0] = '\0';
-			user_input_size = 0;
-			moveToUserInput();
-			printAsciControl(COM2, ASCI_CLEAR_TO_EOL, NO_ARG, NO_ARG);
+			panel_loop.user_input_size = 0;
+			panel_loop.user_input_echoed = 0;
+			panel_loop.user_input_clear = TRUE;
 		}
 	}
 	return 0;
 }
 
 /*
- * Sensor Data Collection
+ * Headless Mode
  */
 
-void sensorBootstrap(){
-	int i, j;
-	for(i = 0; i < SENSOR_DECODER_TOTAL; i++) {
-		sensor_decoder_ids[i] = 'A' + i;
-		for(j = 0; j < SENSOR_BYTE_EACH; j++) {
-			sensor_decoder_data[i * SENSOR_BYTE_EACH + j] = 0x00;
-		}
-	}
-	sensor_request_cts = TRUE;
-
-	// DEBUG_JMP(DB_SENSOR, LINE_DEBUG, COLUMN_FIRST, "Sensor: Booting\n");
-	while((!getRegisterBit(UART1_BASE, UART_FLAG_OFFSET, RXFE_MASK))) {
-		plputc(COM2, '.');
-		char c;
-		if(plgetc(COM1, &c) > 0) {
-			// DEBUG(DB_SENSOR, "Sensor: Consuming sensor data 0x%x\n", c);
-		}
-		plsend(COM2); // Send debug message chars
-	}
-	pushTrainCommand(SENSOR_AUTO_RESET, TRAIN_COMMAND_DELAY, FALSE);
+// Frames in place of the screen from now on, starting with the state a reader needs
+void startHeadless() {
+	int i;
+	printAsciControl(COM2, ASCI_CLEAR_SCREEN, NO_ARG, NO_ARG);
+	panel_loop.headless = TRUE;
+	plsetframer(COM2, telemetryFramer);
+	plsetfifo(COM2, ON); // Command frames come in bursts, nothing is echoed
+	telemetryHello();
+	for(i = 0; i < SWITCH_TOTAL; i++) printSwitchState(i);
+	panel_loop.headless_loops = 0;
 }
 
-void receivedSensorData() {
-	train_commands_pause_time = FALSE;
-	sensor_request_cts = TRUE;
+void stopHeadless() {
+	int i;
+	panel_loop.headless = FALSE;
+	plsetframer(COM2, 0);
+	plsetfifo(COM2, OFF);
+	initializeScreen();
+	for(i = 0; i < SWITCH_TOTAL; i++) {
+		if(switch_states[i] != SWITCH_UNKNOWN) printSwitchState(i);
+	}
+	printCom1Status();
+	printRules();
+	printSensorPolling();
+	printBoot();
 }
 
-void requestSensorData(){
-	sensor_request_cts = FALSE;
-	sensor_request_time = 0;
-	
-	int decoder_index = sensor_decoder_next / SENSOR_BYTE_EACH;
-	sensor_decoder_next = decoder_index * SENSOR_BYTE_EACH;
-	char command = SENSOR_READ_ONE + (sensor_decoder_next / SENSOR_BYTE_EACH) + 1;
-	pushTrainCommand(command, SENSOR_REQUEST_DELAY, TRAIN_COMMAND_PAUSE_TIMEOUT);
-	// DEBUG_JMP(DB_SENSOR, LINE_DEBUG + SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH + 1, COLUMN_SENSOR_DEBUG, "Req %d\n", command);
+void sendTelemetryStats() {
+	ControlStats control;
+	TelemetryStats stats;
+	controlStats(&control);
+	stats.tick = control.tick;
+	stats.loops = panel_loop.headless_loops;
+	stats.queued = control.queued;
+	stats.dropped = control.dropped;
+	stats.stalls = control.stalls;
+	stats.stalled = control.stalled;
+	telemetryStats(&stats);
+	panel_loop.headless_loops = 0;
 }
 
-void pushRecentSensor(char decoder_id, unsigned int sensor_id, unsigned int value) {	
+/*
+ * Handlers of the control core
+ */
+
+void pushRecentSensor(char decoder_id, unsigned int sensor_id) {
 	moveCursorTo(LINE_RECENT_SENSOR, COLUMN_VALUES + sensor_recent_next * COLUMN_WIDTH);
 	plprintf(COM2, "%c%d   ", decoder_id, sensor_id);
 	if((sensor_id / 10) == 0) plputc(COM2, ' ');
@@ -522,159 +720,163 @@ void pushRecentSensor(char decoder_id, unsigned int sensor_id, unsigned int valu
 	plprintf(COM2, "-Next-| ");
 }
 
-void saveDecoderData(unsigned int decoder_index, char new_data) {
-	// Save to sensor_decoder_data
-	char old_data = sensor_decoder_data[decoder_index];
-	sensor_decoder_data[decoder_index] = new_data;
-	
-	// If changed
-	if(new_data && old_data != new_data) {
-	// if(new_data) {
-		// DEBUG_JMP(DB_SENSOR, LINE_DEBUG + decoder_index, COLUMN_SENSOR_DEBUG, "%c%d: 0x%x\n", sensor_decoder_ids[decoder_index / 2], decoder_index % 2, new_data);
-		
-		char decoder_id = sensor_decoder_ids[decoder_index / 2];
-		char old_temp = old_data;
-		char new_temp = new_data;
-		
-		// Found which sensor changed
-		int i;
-		unsigned int old_bit, new_bit;
-		for(i = 0; i < SENSOR_BYTE_SIZE; i++) {
-			old_bit = old_temp & SENSOR_BIT_MASK;
-			new_bit = new_temp & SENSOR_BIT_MASK;
-			// If changed
-			if(new_bit && old_bit != new_bit) {
-				int sensor_id = (SENSOR_BYTE_SIZE * (decoder_index % 2)) + (SENSOR_BYTE_SIZE - i);
-				// DEBUG_JMP(DB_SENSOR, LINE_DEBUG - 1, COLUMN_SENSOR_DEBUG, "#%c%d %x -> %x\n", sensor_decoder_ids[decoder_index / 2], sensor_id, 0 /*old_bit*/, new_bit);
-				
-				pushRecentSensor(decoder_id, sensor_id, new_bit);
-			}
-			old_temp = old_temp >> 1;
-			new_temp = new_temp >> 1;
-		}
+// A sensor frame per decoder byte when headless, the sensors newly tripped otherwise
+void handleSensorTripped(unsigned int decoder_index, char data, char tripped) {
+	int i;
+	if(panel_loop.headless) {
+		telemetrySensor(decoder_index, data, tripped);
+		return;
+	}
+	for(i = 0; i < SENSOR_BYTE_SIZE; i++) {
+		if((tripped >> i) & 1) pushRecentSensor('A' + decoder_index / SENSOR_BYTE_EACH, SENSOR_NUMBER(decoder_index, i));
 	}
 }
 
-void collectSensorData(int tick_elapsed) {
-	char new_data = '\0';
-	if(plgetc(COM1, &new_data) > 0) {
-		// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG - 1, COLUMN_FIRST, "Data In %d     \n", sensor_decoder_next);
-		sensor_request_time = 0;
-		
-		// Save the data
-		saveDecoderData(sensor_decoder_next, new_data);
-		
-		// Increment the counter
-		sensor_decoder_next = (sensor_decoder_next + 1) % (SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH);
-		// DEBUG_JMP(DB_SENSOR, LINE_DEBUG + SENSOR_DECODER_TOTAL * SENSOR_BYTE_EACH, COLUMN_SENSOR_DEBUG, "N %d\n", sensor_decoder_next);
-		
-		// If end receiving last chunk of data, clear to send sensor data request
-		if((sensor_decoder_next % 2) == 0) {
-			receivedSensorData();
-			// DEBUG_JMP(DB_TRAIN_CTRL, LINE_DEBUG - 1, COLUMN_FIRST, "Continue   ");
-		}
-	}
-	
-	if(sensor_request_cts == FALSE) {
-		sensor_request_time += tick_elapsed;
-	} 
-	// Request for another chunk of data
-	int sending_delay = train_commands_buffer[train_commands_send_index].delay;
-	if(sending_delay > TRAIN_COMMAND_DELAY) {
-		sensor_request_time = 0;
-	}
-	if(sensor_request_cts == TRUE || (sensor_request_time > SENSOR_REQUEST_TIMEOUT)) {
-		if(sensor_request_time > SENSOR_REQUEST_TIMEOUT) {
-			// DEBUG_JMP(DB_SENSOR, LINE_DEBUG - 1, COLUMN_FIRST, "Restart %d", sensor_request_time);
-		}
-		requestSensorData();
-	}
+void handleSwitchThrown(unsigned int index) {
+	printSwitchState(index);
 }
 
-/* 
- * Main Polling Loop
- */
-void pollingLoop() {
-	/* Initialize Elapsed time tracker */
-	previous_timer_value = getTimerValue(TIMER3_BASE);
-	timer_value_remained = 0;
-	timer_tick = 0;
+static const ControlHandlers panel_handlers = {
+	handleSensorTripped,
+	handleSwitchThrown,
+	printRoute,
+	printCom1Status,
+	printRules,
+};
+
+// From the debug timer value since to now, in us
+static inline unsigned int bootElapsed(unsigned int since) {
+	return (getDebugTimerValue() - since) * DEBUG_TIMER_US_NUMERATOR / DEBUG_TIMER_US_DENOMINATOR;
+}
+
+void panelBootstrap() {
+	unsigned int started = getDebugTimerValue();
+	controlBootstrap(&panel_handlers);
+	commandBootstrap();
 	
-	/* Initialize Train Command Buffer */
-	train_commands_save_index = 0;
-	train_commands_send_index = 0;
-	train_commands_pause_time = 0;
-	train_commands_buffer[train_commands_send_index].delay = 0;
-		
 	/* Initialize User Input Buffer */
-	user_input_size = 0;
-	user_input_buffer[user_input_size] = '\0';
-	
-	sensor_decoder_next = 0;
+	panel_loop.user_input_size = 0;
+	panel_loop.user_input_echoed = 0;
+	user_input_buffer[panel_loop.user_input_size] = '\0';
+	command_frame.received = 0;
 	sensor_recent_next = 0;
 	
-	/* Initialize Sensor Data Request */
-	sensorBootstrap();
+	boot_phases[BOOT_PHASE_CORE] = bootElapsed(started);
 	
 	/* Initialize the screen */
+	started = getDebugTimerValue();
 	initializeScreen();
+	printCom1Status();
+	printRules();
+	printSensorPolling();
+	boot_phases[BOOT_PHASE_SCREEN] = bootElapsed(started);
+}
+
+/* 
+ * Main Polling Loop
+ */
+void pollingLoop() {
+	PlChannel *com2 = plchannel(COM2);
+	int booting = TRUE;
+	
+	panelBootstrap();
 	
 	/* Polling loop */
 	while(TRUE) {
 		
-		/* Polling IO: Give it a chance to send out char */
-		plsend(COM1);
-		plsend(COM2);
+		/* Polling IO: Give it a chance to send out char, on a fresh snapshot of the flags */
+		plchinvalidate(com2);
+		plchsend(com2);
 		
-		/* Timer: Calculate and display time elapsed */
-		unsigned int tick_elapsed = handleTimeElapse();
-		
-		/* Try to pop train commands from the buffer */
-		popTrainCommand(tick_elapsed);
-		
-		/* Sensor: Collect and display data */
-		collectSensorData(tick_elapsed);
+		/* Control core: COM1, clock, train commands, trains and sensors */
+		unsigned int tick_elapsed = controlPoll();
+		if(tick_elapsed > 0) {
+			printElapsedTime();
+			if(control_loop.tick % SENSOR_POLLING_TICKS < tick_elapsed) printSensorPolling();
+		}
 		
 		/* User Input */
 		if(handleUserInput() == USER_COMMAND_QUIT) break;
+		echoUserInput();
+		
+		/* Headless: clock and loop stats */
+		if(panel_loop.headless) {
+			panel_loop.headless_loops++;
+			if(tick_elapsed > 0 && control_loop.tick % TELEMETRY_STATS_TICKS < tick_elapsed) sendTelemetryStats();
+		}
+		
+		/* Boot: over with the first pass */
+		if(booting) {
+			boot_phases[BOOT_PHASE_READY] = bootElapsed(boot_started);
+			printBoot();
+			booting = FALSE;
+		}
 	}
 }
 
 int main(int argc, char* argv[]) {
 	
+	/* Initialize Timer: the debug timer first, it times the boot phases */
+	setDebugTimer(TRUE);
+	boot_started = getDebugTimerValue();
+	
 	/* Initialize Global Variables */
 	char plio_buffer[CHANNEL_COUNT * OUTPUT_BUFFER_SIZE];
-	unsigned int plio_send_index[CHANNEL_COUNT];
-	unsigned int plio_save_index[CHANNEL_COUNT];
-	dbflags = 0 /* DB_TRAIN_CTRL | DB_IO | DB_TIMER | DB_USER_INPUT | DB_SENSOR */; // Debug Flags
+	PlRecord plio_records[PLIO_RECORD_MAX];
+	memoryPaintStack(__builtin_frame_address(0), MEMORY_STACK_PAINT_SIZE); // Above the buffers of main
+	plio_record_ring = plio_records;
+	boot_phases[BOOT_PHASE_STACK] = bootElapsed(boot_started);
 	
 	/* Initialize IO: setup buffer; BOTH: turn off fifo; COM1: speed to 2400, enable stp2 */
-	plbootstrap(plio_buffer, plio_send_index, plio_save_index);
+	unsigned int started = getDebugTimerValue();
+	plbootstrap(plio_buffer);
+	plsetframer(COM1, frameTrainCommand);
+	telemetryBootstrap(COM2);
 	plsetfifo(COM2, OFF);
 	plsetfifo(COM1, OFF);
 	plsetspeed(COM1, 2400);
 	setRegisterBit(UART1_BASE, UART_LCRH_OFFSET, STP2_MASK, TRUE);
 	
-	/* Verifiying COM1's Configuration: nothing when debug flag is turned off */
-	// DEBUG_JMP(DB_IO, LINE_DEBUG, COLUMN_FIRST, "COM1 LCRH: 0x%x\n", getRegister(UART1_BASE, UART_LCRH_OFFSET)); // 0x68
-	// DEBUG(DB_IO, "COM1 LCRM: 0x%x\n", getRegister(UART1_BASE, UART_LCRM_OFFSET)); // 0x0
-	// DEBUG(DB_IO, "COM1 LCRL: 0x%x\n", getRegister(UART1_BASE, UART_LCRL_OFFSET)); // 0xbf
-	// DEBUG(DB_IO, "COM1 CTRL: 0x%x\n", getRegister(UART1_BASE, UART_CTLR_OFFSET)); // 0x1
-	// DEBUG(DB_IO, "COM1 FLAG: 0x%x\n", getRegister(UART1_BASE, UART_FLAG_OFFSET)); // 0x91
-	// DEBUG(DB_IO, "IO Initialized.\n");
+	/* Verifiying COM1's Configuration: nothing when tracing is compiled out */
+	TRACE(TRACE_UART_CONFIG, UART_LCRH_OFFSET, getRegister(UART1_BASE, UART_LCRH_OFFSET)); // 0x68
+	TRACE(TRACE_UART_CONFIG, UART_LCRM_OFFSET, getRegister(UART1_BASE, UART_LCRM_OFFSET)); // 0x0
+	TRACE(TRACE_UART_CONFIG, UART_LCRL_OFFSET, getRegister(UART1_BASE, UART_LCRL_OFFSET)); // 0xbf
+	TRACE(TRACE_UART_CONFIG, UART_CTLR_OFFSET, getRegister(UART1_BASE, UART_CTLR_OFFSET)); // 0x1
+	TRACE(TRACE_UART_CONFIG, UART_FLAG_OFFSET, getRegister(UART1_BASE, UART_FLAG_OFFSET)); // 0x91
+	
+	/* Account the buffers for the mem command */
+	memoryRegister("plio rings", plio_buffer, sizeof(plio_buffer));
+	memoryRegister("plio records", plio_records, sizeof(plio_records));
+	memoryRegister("train cmds", train_commands_buffer, sizeof(train_commands_buffer));
+	memoryRegister("rule cmds", rule_commands_buffer, sizeof(rule_commands_buffer));
+	memoryRegister("rules", rules, sizeof(rules));
+	memoryRegister("user input", user_input_buffer, sizeof(user_input_buffer));
+	memoryRegister("script", script_buffer, sizeof(script_buffer));
+	memoryRegister("sensor data", sensor_decoder_data, sizeof(sensor_decoder_data));
+	memoryRegister("trains", train_states, sizeof(train_states));
+	memoryRegister("switch ids", switch_ids, sizeof(switch_ids));
+	memoryRegister("switch states", switch_states, sizeof(switch_states));
+	memoryRegister("track nodes", track_nodes, sizeof(track_nodes));
+	boot_phases[BOOT_PHASE_IO] = bootElapsed(started);
 	
 	/* Initialize Timer: Enable Timer3 with free running mode and 2kHz clock */
 	setTimerControl(TIMER3_BASE, TRUE, FALSE, FALSE);
-	// DEBUG(DB_TIMER, "Timer3 value start with 0x%x.\n", getTimerValue(TIMER3_BASE));
 	
 	pollingLoop();
 	
 	setTimerControl(TIMER3_BASE, FALSE, FALSE, FALSE);
-	moveCursorTo(LINE_BOTTOM, COLUMN_FIRST);
+	setDebugTimer(FALSE);
+	if(!panel_loop.headless) moveCursorTo(LINE_BOTTOM, COLUMN_FIRST);
 	
 	// plflush(COM1);
 	plflush(COM2);
 	
+	/* Dump the traffic recording, if any */
+	unsigned int first, count;
+	plrecorded(&first, &count);
+	if(count > 0) pldump(COM2);
+	if(TRACE_ENABLED) traceDump(COM2);
+	
 	// plstat();
 	return 0;
 }
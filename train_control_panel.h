@@ -0,0 +1,42 @@
+/*
+ * train_control_panel.h - entry points of the panel, for the host tools
+ *
+ * The panel is the terminal client of the control core, see control.h
+ */
+
+#ifndef __TRAIN_CONTROL_PANEL_H__
+#define __TRAIN_CONTROL_PANEL_H__
+
+#include <telemetry.h>
+#include <control.h>
+
+void printAsciControl(int channel, char *control, int arg1, int arg2);
+
+void initializeScreen();
+
+// Bootstrap the control core with the panel as its client, then draw the screen
+void panelBootstrap();
+
+int handleUserCommand(const char *input);
+
+/*
+ * What every pass of the polling loop reads or writes in the panel: the
+ * modes, and how much of the input line is on screen
+ */
+typedef struct PanelLoop {
+	int headless;	// Framed binary telemetry on COM2 in place of the screen, see telemetry.h
+	unsigned int headless_loops;	// Polling loop cycles since the last stats frame
+	unsigned int script_mode;
+	unsigned int user_input_size;
+	unsigned int user_input_echoed;	// Chars of the input line on screen
+	int user_input_clear;	// Clear after the echoed chars, the line got shorter
+} PanelLoop;
+
+extern PanelLoop panel_loop;
+
+// Binary command frame being received on COM2, run by handleCommandFrame once complete
+extern TelemetryReceiver command_frame;
+
+int handleCommandFrame(int received);
+
+#endif // __TRAIN_CONTROL_PANEL_H__